@@ -0,0 +1,49 @@
+#!/bin/bash
+# Links synthetic object set with many 32-bit relocations and reports link time for each number of jobs.
+# Usage : ./bench_reloc.sh [objects] [relocations per object] [sections] [jobs ...]
+# Defaults give 200 objects x 5000 relocations (one million), spread over 16 output sections.
+
+ASSEMBLER=${ASSEMBLER:-./as}
+LINKER=${LINKER:-./ld}
+OBJECTS=${1:-200}
+PER_OBJECT=${2:-5000}
+SECTIONS=${3:-16}
+shift $(( $# < 3 ? $# : 3 ))
+JOBS=${@:-1 $(nproc)}
+
+for J in ${JOBS}; do
+  if ! [[ ${J} =~ ^[1-9][0-9]*$ ]]; then
+    echo "Number of jobs must be positive integer : ${J}" >&2
+    exit 1
+  fi
+done
+
+WORK=$(mktemp -d)
+trap 'rm -rf "${WORK}"' EXIT
+
+# Object i defines b<i> and fills its section with words referencing b<i> and b<i+1>
+for ((i = 0; i < OBJECTS; i++)); do
+  awk -v i=${i} -v n=$(( (i + 1) % OBJECTS )) -v count=${PER_OBJECT} -v sec=$(( i % SECTIONS )) 'BEGIN {
+    print ".global b" i
+    if(n != i) print ".extern b" n
+    print ".section rel" sec
+    print "b" i ":"
+    for(k = 0; k < count; k += 10) {
+      line = ".word "
+      for(j = 0; j < 10 && k + j < count; j++)
+        line = line ((j > 0) ? ", " : "") "b" (((k + j) % 2) ? n : i)
+      print line
+    }
+    print ".end"
+  }' > "${WORK}/b${i}.s"
+  ${ASSEMBLER} -o "${WORK}/b${i}.o" "${WORK}/b${i}.s" > /dev/null || exit 1
+done
+
+OBJS=$(for ((i = 0; i < OBJECTS; i++)); do echo "${WORK}/b${i}.o"; done)
+echo "$((OBJECTS * PER_OBJECT)) relocations in ${OBJECTS} objects, ${SECTIONS} sections"
+for J in ${JOBS}; do
+  START=$(date +%s%N)
+  ${LINKER} -hex -jobs=${J} -o "${WORK}/bench.hex" ${OBJS} > /dev/null || exit 1
+  END=$(date +%s%N)
+  echo "jobs ${J} : $(( (END - START) / 1000000 )) ms"
+done
@@ -8,7 +8,10 @@ EMULATOR=./emu
 
 # g++ -g -o as ./src/assembler.cpp
 # g++ -g -o ld ./src/linker.cpp
-# g++ -g -o emu ./src/emulator.cpp
+# g++ -g -o emu ./src/emulator.cpp -ldl
+# emulator built as above runs -lanes rows scalar, they are vectorized only with -O3:
+# g++ -g -O3 -o emu ./src/emulator.cpp -ldl
+# g++ -g -o ar ./src/archiver.cpp
 
 ${ASSEMBLER} -o main.o main.s
 ${ASSEMBLER} -o math.o math.s
@@ -0,0 +1,47 @@
+#ifndef _ARCHIVER_HPP
+#define _ARCHIVER_HPP
+
+#include "./exception.hpp"
+#include "./structures.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+using namespace std;
+
+#define MIN_CMD_ARGS 4
+
+// One object file put into archive, with global symbols it defines
+struct s_ArInput {
+  string                  name;
+  vector<char>            content;
+  vector<string>          defined;
+};
+
+class Archiver{
+private:
+
+  string                  outFileName;
+  vector<s_ArInput>       members;
+  // symbol name to member that defines it, first definition wins
+  unordered_map<string, uint32_t> index;
+
+  uint64_t read(const vector<char> &content, uint64_t pos, int len);
+
+public:
+
+  Archiver(string outFile);
+
+  void add_member(string fileName);
+  void write_archive();
+
+};
+
+#endif
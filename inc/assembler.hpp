@@ -82,16 +82,7 @@ const string e_n_LineType[] =  {"LABEL", "DIRECTIVE", "INSTRUCTION", "L_D", "L_I
 // definisanje vrednosti za polja sekcija
 
 enum e_SecType {SEC_TYPE_NULL = 0, SEC_TYPE_PROGBITS, SEC_TYPE_SYMTAB, SEC_TYPE_STRTAB, SEC_TYPE_RELA, SEC_TYPE_DYNAMIC, SEC_TYPE_NOTE, SEC_TYPE_NOBITS, SEC_TYPE_REL};
-const string e_n_SecType [] = {"NULL", "PROGBITS", "SYMTAB", "STRTAB", "RELA", "", "DYNAMIC", "NOTE", "NOBITS", "REL", "HDRTAB"};
-
-// Sec flags
-#define SEC_FLAGS_WRITE (1 << 0) /* Writable */
-#define SEC_FLAGS_ALLOC (1 << 1) /* Occupies memory during execution */
-#define SEC_FLAGS_EXECINSTR (1 << 2) /* Executable */
-#define SEC_FLAGS_MERGE (1 << 4) /* Might be merged */
-#define SEC_FLAGS_STRINGS (1 << 5) /* Contains nul-terminated strings */
-#define SEC_FLAGS_INFO_LINK (1 << 6) /* 'sh_info' contains SHT index */
-#define SEC_FLAGS_GROUP (1 << 9) /* Section is member of a group. */
+const string e_n_SecType [] = {"NULL", "PROGBITS", "SYMTAB", "STRTAB", "RELA", "", "DYNAMIC", "NOTE", "NOBITS", "REL", "HDRTAB", "LINES", "POOL"};
 
 // Definisanje vrednosti za polja symbol table
 
@@ -130,9 +121,11 @@ struct s_LineStruct {
   string            info;
   int               param_begin;
   vector<string>    operands;
+  // line number in source file, starting from 1
+  int               src_line;
 
   // Constructor(
-  s_LineStruct (string line = "", e_LineType type = LABEL, string info = "", int param_begin = 0, vector<string> operands = vector<string>()) : line(line), type(type), info(info), param_begin(param_begin), operands(operands) { }
+  s_LineStruct (string line = "", e_LineType type = LABEL, string info = "", int param_begin = 0, vector<string> operands = vector<string>(), int src_line = 0) : line(line), type(type), info(info), param_begin(param_begin), operands(operands), src_line(src_line) { }
 };
 
 // This represents one entry in symbol table
@@ -339,6 +332,15 @@ struct s_RelocAdd {
 #define __REG_STATUS 0x0
 #define __REG_HANDLER 0x1
 #define __REG_CAUSE 0x2
+// read only counters, 64 bit ones are split to low and high word
+#define __REG_CYCLE 0x3
+#define __REG_CYCLEH 0x4
+#define __REG_INSTRET 0x5
+#define __REG_INSTRETH 0x6
+#define __REG_INTCNT 0x7
+
+const map<string, uint8_t> csr_map = {{"status", __REG_STATUS}, {"handler", __REG_HANDLER}, {"cause", __REG_CAUSE}, {"cycle", __REG_CYCLE}, 
+  {"cycleh", __REG_CYCLEH}, {"instret", __REG_INSTRET}, {"instreth", __REG_INSTRETH}, {"intcnt", __REG_INTCNT}};
 
 const map<string, int> directive_map = {{".global", -1}, {".extern", -1}, {".section", 1}, {".word", -1}, {".skip", 1}, {".end", 0}};
 
@@ -392,6 +394,9 @@ private:
   ofstream          outputFile;
   ifstream          inputFile;
   ofstream          helperFile;
+  // source file as it was opened, written to line table
+  string            srcFile;
+  bool              lineTableOn;
 
   // helper structures
   vector<s_Sym>                           symTable;
@@ -401,6 +406,9 @@ private:
   map<int, vector<uint8_t>>               sec_content;
   map<s_LitSym, vector<s_LiteralPool>>    literals;
   map<int, vector<s_LitSym>>              sec_literals;
+  map<int, vector<s_LineEnt>>             line_table;
+  // instructions reading literal pool of section, so linker can merge pools
+  map<int, vector<s_PoolRef>>             pool_refs;
 
   // assembler work
   long long                               locationCounter = 0;
@@ -416,7 +424,7 @@ private:
 public:
 
   // constructors
-  Assembler(string outFile, string inFile);
+  Assembler(string outFile, string inFile, bool lineTable = false);
   // Destructor
   ~Assembler();
 
@@ -447,6 +455,7 @@ public:
   string get_op_type(string op);
   void add_literal_to_pool(int lit);
   void add_symbol_to_pool(string sym);
+  void add_pool_ref(uint32_t offset, int index);
   bool is_number(const string& str);
   vector<string> get_mem_ops(string op);
   int get_index_of_literal_for_section(int lit);
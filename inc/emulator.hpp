@@ -13,13 +13,27 @@
 #include <iomanip>
 #include <set>
 #include <limits>
+#include <memory>
+#include <unordered_map>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <csignal>
+#include <sys/time.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "./exception.hpp"
 #include "./structures.hpp"
+#include "./plugin.hpp"
 
 using namespace std;
 
 #define SPACE_CHAR ' '
+#define COMMA_CHAR ','
 #define WORD_SIZE 4
 
 #define _r0 0
@@ -40,20 +54,416 @@ using namespace std;
 #define _r15 15
 #define _sp 14
 #define _pc 15
+#define _num_regs 16
 
 #define _status 0
 #define _handle 1
 #define _cause 2
+// read only counters, computed only when read
+#define _csr_cycle 3
+#define _csr_cycleh 4
+#define _csr_instret 5
+#define _csr_instreth 6
+#define _csr_intcnt 7
+
+// interrupt causes, also index of the entry in the vector table
+#define _cause_bad_inst 1
+#define _cause_timer 2
+#define _cause_terminal 3
+#define _cause_software 4
+#define _cause_block 5
+#define _num_causes 16
+
+// status flags
+#define _status_tr 0x1
+#define _status_tl 0x2
+#define _status_i 0x4
+// current priority level, only used in vectored mode
+#define _status_cpl_shift 4
+#define _status_cpl_mask 0xf0
+#define _max_irq_prio 15
 
 #define pc_start_addr 0x40000000
 
+// memory mapped registers take 256 bytes from 0xFFFFFF00
+#define _mmio_base 0xFFFFFF00
+// block device, sector addressed, transfers whole sectors between host file and memory
+#define _blk_cmd 0xFFFFFF40
+#define _blk_status 0xFFFFFF44
+#define _blk_sector 0xFFFFFF48
+#define _blk_count 0xFFFFFF4C
+#define _blk_dma 0xFFFFFF50
+// read only, number of sectors of device
+#define _blk_size 0xFFFFFF54
+#define _blk_sector_size 512
+#define _blk_cmd_read 1
+#define _blk_cmd_write 2
+#define _blk_cmd_flush 3
+// status bits, writing 1 clears them
+#define _blk_status_done 0x1
+#define _blk_status_error 0x2
+// semihosting, writing call number to doorbell makes host call with arguments in r1-r3,
+// result is put in r1 (0xFFFFFFFF on error)
+#define _semi_doorbell 0xFFFFFF60
+#define _semi_write 1
+#define _semi_read 2
+#define _semi_open 3
+#define _semi_close 4
+#define _semi_clock 5
+#define _semi_exit 6
+// modes of open
+#define _semi_open_read 0
+#define _semi_open_write 1
+#define _semi_open_append 2
+#define _semi_max_path 4096
+#define _semi_chunk 65536
+
+// timing model defaults, in virtual cycles
+#define _default_inst_cycles 1
+#define _default_mem_latency 3
+#define _default_int_entry_cycles 4
+#define _default_int_exit_cycles 2
+
+// Timing policies for Emulator::run, chosen at compile time so functional run pays nothing for them
+struct s_NoTiming {
+  void retire(uint32_t inst_pc, char oc, char mod) { }
+  void interrupt_entry() { }
+  void interrupt_exit() { }
+};
+
+class CycleTiming {
+private:
+  // cost of instruction indexed by [opcode][mode], memory latency already included
+  uint32_t                            cost[16][16];
+  uint32_t                            mem_latency;
+  uint32_t                            int_entry_cost;
+  uint32_t                            int_exit_cost;
+  uint64_t                            cycles;
+  uint64_t                            instructions;
+
+  // attribution of cycles to symbols, cur_* caches range of symbol that pc is in
+  vector<uint32_t>                    sym_addr;
+  vector<string>                      sym_name;
+  vector<uint64_t>                    sym_cycles;
+  uint32_t                            cur_lo;
+  uint32_t                            cur_hi;
+  int                                 cur_sym;
+
+public:
+  CycleTiming(string costFile, const map<uint32_t, string> &symbols);
+
+  void retire(uint32_t inst_pc, char oc, char mod) {
+    if(inst_pc < cur_lo || inst_pc >= cur_hi)
+      find_symbol(inst_pc);
+    uint32_t c = cost[hex_nibble(oc)][hex_nibble(mod)];
+    cycles += c;
+    instructions++;
+    if(cur_sym >= 0)
+      sym_cycles[cur_sym] += c;
+  }
+  void interrupt_entry();
+  void interrupt_exit();
+  void report(ostream &out);
+  uint64_t get_cycles() { return cycles; }
+
+private:
+  static int hex_nibble(char ch) { return (ch <= '9') ? (ch - '0') : ((ch | 0x20) - 'a' + 10) & 0xf; }
+  int mem_accesses(int oc, int mod);
+  void find_symbol(uint32_t addr);
+};
+
+
+// paged memory, 4KB pages in two level table indexed by addr[31:22] and addr[21:12]
+#define _page_shift 12
+#define _page_size (1 << _page_shift)
+#define _page_mask (_page_size - 1)
+#define _dir_shift 22
+#define _dir_size 1024
+#define _table_size 1024
+#define _table_mask (_table_size - 1)
+
+// page flags, access to a page with any of these set goes through slow path
+#define _page_watch_read 0x1
+#define _page_watch_write 0x2
+#define _page_trace 0x4
+// page not written since last checkpoint, first write saves its old content
+#define _page_snapshot 0x8
+// writes are matched against address searched by reverse continue
+#define _page_track 0x10
+// page not written since last verify compare, first write records it
+#define _page_verify 0x20
+// loads and stores are reported to plugin
+#define _page_plugin 0x40
+// page holds device registers
+#define _page_mmio 0x80
+// page belongs to shared image, first write makes private copy
+#define _page_shared 0x100
+#define _page_slow_read (_page_watch_read | _page_trace | _page_plugin | _page_mmio)
+#define _page_slow_write (_page_watch_write | _page_trace | _page_snapshot | _page_track | _page_verify | _page_plugin | _page_mmio | _page_shared)
+
+// written and coverage bitmaps of a page have one bit per word
+#define _cov_words (_page_size / WORD_SIZE / 32)
+
+struct s_Page {
+  uint8_t               data[_page_size];
+  // words written by loader, stores or dma, others hold no instruction or data
+  uint32_t              written[_cov_words];
+};
+
+// instruction decoded once, when image is loaded
+struct s_DecodedInst {
+  char                  oc;
+  char                  mod;
+  uint8_t               regA;
+  uint8_t               regB;
+  uint8_t               regC;
+  int32_t               disp;
+};
+
+#define _page_words (_page_size / WORD_SIZE)
+
+struct s_ImagePage {
+  s_Page                page;
+  s_DecodedInst         code[_page_words];
+};
+
+struct s_PageEntry {
+  // nullptr until something is written to the page
+  s_Page                *page;
+  // nullptr if page has no source lines
+  uint32_t              *cov;
+  // decoded words of shared image page, nullptr once page is private
+  const s_DecodedInst   *code;
+  uint16_t              flags;
+};
+
+class SharedImage;
+
+// hex file already loaded from path, it isn't read again while its size and mtime stay the same
+struct s_ImageFile {
+  int64_t                                       size;
+  int64_t                                       mtime;
+  weak_ptr<SharedImage>                         image;
+
+  s_ImageFile(int64_t size = 0, int64_t mtime = 0, weak_ptr<SharedImage> image = weak_ptr<SharedImage>()) : size(size), mtime(mtime), image(image) { }
+};
+
+// Pages of loaded hex file with every word already decoded. Instances that load same image
+// share it through registry keyed by hash of file content, and never write to it. Pages are
+// compared when hashes are equal, so images with colliding hashes are never mixed up.
+class SharedImage {
+private:
+  map<uint32_t, unique_ptr<s_ImagePage>>        pages;
+
+  static mutex                                                      registry_mutex;
+  static unordered_map<uint64_t, vector<weak_ptr<SharedImage>>>     registry;
+  static unordered_map<string, s_ImageFile>                         files;
+
+public:
+  SharedImage(const string &content);
+
+  static shared_ptr<SharedImage> get(const string &fileName, istream &input);
+  bool same_pages(const SharedImage &other) const;
+  static s_DecodedInst decode(uint32_t inst);
+  const map<uint32_t, unique_ptr<s_ImagePage>> &get_pages() { return pages; }
+};
+
+// instruction address generated from line of source file, loaded from line table of linker
+struct s_SrcLine {
+  uint32_t              addr;
+  int                   line;
+  string                file;
+
+  s_SrcLine(uint32_t addr = 0, int line = 0, string file = "") : addr(addr), line(line), file(file) { }
+};
+
+struct s_PageTable {
+  s_PageEntry           entries[_table_size];
+};
+
+// watchpoints
+#define _watch_read 0x1
+#define _watch_write 0x2
+
+struct s_Watchpoint {
+  uint32_t              start;
+  // one past last watched byte
+  uint64_t              end;
+  int                   kind;
+  bool                  stop;
+
+  s_Watchpoint(uint32_t start = 0, uint64_t end = 0, int kind = _watch_write, bool stop = false) : start(start), end(end), kind(kind), stop(stop) { }
+};
+
+// checkpoints for reverse execution
+#define _default_checkpoint_interval 1000000
+#define _default_checkpoint_budget (64 << 20)
+#define _no_checkpoint UINT64_MAX
+
+struct s_Checkpoint {
+  // number of instructions retired when checkpoint was taken
+  uint64_t                                    inst_count;
+  map<int, uint32_t>                          regs;
+  map<int, uint32_t>                          control_regs;
+  uint32_t                                    pending_irqs;
+  int                                         intrpt;
+  uint32_t                                    int_count;
+  // old content of pages written after checkpoint, nullptr if page was not mapped
+  vector<pair<uint32_t, unique_ptr<s_Page>>>  undo;
+
+  s_Checkpoint(uint64_t inst_count = 0) : inst_count(inst_count), pending_irqs(0), intrpt(0), int_count(0) { }
+};
+
+// cache simulator
+#define _cache_batch_size 4096
+#define _cache_report_top 10
+#define _max_sym_offset 0x10000
+
+#define _acc_fetch 0
+#define _acc_read 1
+#define _acc_write 2
+
+enum e_CachePolicy {CACHE_LRU = 0, CACHE_FIFO, CACHE_RANDOM};
+const string e_n_CachePolicy [] = {"lru", "fifo", "random"};
+
+struct s_MemAccess {
+  // pc of instruction that made the access
+  uint32_t              pc;
+  uint32_t              addr;
+  uint8_t               kind;
+  // value loaded or stored, kept only for plugins
+  uint32_t              val;
+
+  s_MemAccess(uint32_t pc = 0, uint32_t addr = 0, uint8_t kind = _acc_fetch, uint32_t val = 0) : pc(pc), addr(addr), kind(kind), val(val) { }
+};
+
+// Instrumentation plugins, template policy of Emulator::run next to timing policy. Hooks are
+// called from step, so plugin without any (s_NoPlugin) compiles away. Loads and stores go
+// through slow path only while wants_mem() is true.
+struct s_NoPlugin {
+  bool wants_mem() { return false; }
+  void retire(uint32_t inst_pc, char oc, char mod) { }
+  void mem_read(uint32_t inst_pc, uint32_t addr, uint32_t val) { }
+  void mem_write(uint32_t inst_pc, uint32_t addr, uint32_t val) { }
+  void branch(uint32_t from, uint32_t to) { }
+  void interrupt(uint32_t cause, uint32_t handler) { }
+  void halt(uint32_t inst_pc) { }
+};
+
+// Block device backed by host file mapped into emulator, commands are memcpy in and out of
+// the mapping and file is synced only by flush command
+class BlockDevice {
+  friend class Emulator;
+private:
+  int                                 fd;
+  uint8_t                             *data;
+  uint64_t                            size;
+  // registers
+  uint32_t                            status;
+  uint32_t                            sector;
+  uint32_t                            count;
+  uint32_t                            dma;
+
+public:
+  BlockDevice(string fileName);
+  ~BlockDevice();
+
+  uint32_t sectors() { return size / _blk_sector_size; }
+  uint8_t *sector_data(uint32_t sector) { return data + static_cast<uint64_t>(sector) * _blk_sector_size; }
+  void flush();
+};
+
+// Plugin loaded from shared object, see plugin.hpp
+class DynamicPlugin {
+private:
+  void                                *handle;
+  s_PluginHooks                       hooks;
+
+public:
+  DynamicPlugin(string spec);
+  ~DynamicPlugin();
+
+  bool wants_mem() { return hooks.mem_read != nullptr || hooks.mem_write != nullptr; }
+  void retire(uint32_t inst_pc, char oc, char mod) { if(hooks.retire) hooks.retire(hooks.ctx, inst_pc, oc, mod); }
+  void mem_read(uint32_t inst_pc, uint32_t addr, uint32_t val) { if(hooks.mem_read) hooks.mem_read(hooks.ctx, inst_pc, addr, val); }
+  void mem_write(uint32_t inst_pc, uint32_t addr, uint32_t val) { if(hooks.mem_write) hooks.mem_write(hooks.ctx, inst_pc, addr, val); }
+  void branch(uint32_t from, uint32_t to) { if(hooks.branch) hooks.branch(hooks.ctx, from, to); }
+  void interrupt(uint32_t cause, uint32_t handler) { if(hooks.interrupt) hooks.interrupt(hooks.ctx, cause, handler); }
+  void halt(uint32_t inst_pc) { if(hooks.halt) hooks.halt(hooks.ctx, inst_pc); }
+  void finish() { if(hooks.finish) hooks.finish(hooks.ctx); }
+};
+
+// Plugin built into emulator, selected with -profile[=<file>]. Counts retired instructions per
+// opcode, taken branches, loads, stores and interrupts, same report as plugins/inst_profile.cpp
+class InstProfiler {
+private:
+  // report goes to cout if no file is given
+  ofstream                            outFile;
+  uint64_t                            per_oc[16];
+  uint64_t                            branches;
+  uint64_t                            loads;
+  uint64_t                            stores;
+  uint64_t                            interrupts;
+
+public:
+  InstProfiler(string file);
+
+  bool wants_mem() { return true; }
+  void retire(uint32_t, char oc, char) { per_oc[(oc <= '9') ? (oc - '0') : ((oc | 0x20) - 'a' + 10) & 0xf]++; }
+  void mem_read(uint32_t, uint32_t, uint32_t) { loads++; }
+  void mem_write(uint32_t, uint32_t, uint32_t) { stores++; }
+  void branch(uint32_t, uint32_t) { branches++; }
+  void interrupt(uint32_t, uint32_t) { interrupts++; }
+  void halt(uint32_t) { }
+  void finish();
+};
+
+// Set associative cache model, fed with batches of accesses so cost of simulation stays out of emulation loop
+class CacheSim {
+private:
+  string                              name;
+  uint32_t                            size;
+  uint32_t                            assoc;
+  uint32_t                            line_size;
+  uint32_t                            num_sets;
+  int                                 policy;
+  // way w of set s is at [s * assoc + w]
+  vector<uint32_t>                    tags;
+  vector<uint64_t>                    stamp;
+  vector<bool>                        valid;
+  uint64_t                            tick;
+  uint32_t                            rnd;
+
+  uint64_t                            hits;
+  uint64_t                            misses;
+  unordered_map<uint32_t, uint64_t>   miss_pc;
+  unordered_map<uint32_t, uint64_t>   miss_addr;
+
+public:
+  // config is <size>:<assoc>:<line size>[:lru|fifo|random]
+  CacheSim(string name, string config);
+
+  void access_batch(const vector<s_MemAccess> &batch, bool inst);
+  void report(ostream &out, const map<uint32_t, string> &symbols);
+
+private:
+  void access_line(uint32_t pc, uint32_t line_addr);
+};
 
 class Emulator{
+  friend class Lockstep;
+  friend class Verifier;
 private:
 
   // structures used
-  map<uint32_t, vector<string>>       memory;
+  vector<unique_ptr<s_PageTable>>     page_dir;
+  vector<unique_ptr<s_Page>>          pages;
+  // owned by pages, unmapped again when reverse step went back before they were allocated
+  vector<s_Page *>                    free_pages;
+  // or-ed with flags of every page, used for checks that must see all accesses
+  uint16_t                            mem_flags;
   ifstream                            inputFile;
+  shared_ptr<SharedImage>             image;
   string                              inFileName;
   uint32_t                            *pc;
   uint32_t                            *sp;
@@ -76,9 +486,94 @@ private:
   int                                 disp_from_inst;
   int                                 disp;
 
+  // interrupt handling
+  vector<string>                      options;
+  bool                                vectored;
+  uint32_t                            pending_irqs;
+  map<int, int>                       irq_prio;
+  map<int, uint32_t>                  irq_mask;
+
+  // reports
+  bool                                timing_on;
+  // set while running with timing model, source of cycle counter
+  CycleTiming                         *cycle_timing;
+  uint32_t                            int_count;
+  string                              timing_file;
+  string                              sym_file;
+  map<uint32_t, string>               symbols;
+  // every name of symbol map, several can share an address (section and its first label)
+  unordered_map<string, uint32_t>     sym_addrs;
+
+  // cache simulation
+  uint32_t                            cur_inst_pc;
+  unique_ptr<CacheSim>                icache;
+  unique_ptr<CacheSim>                dcache;
+  vector<s_MemAccess>                 access_batch;
+
+  // devices
+  unique_ptr<BlockDevice>             block;
+  bool                                semihost_on;
+  // guest handle -> host fd, 0-2 are stdin, stdout and stderr
+  map<uint32_t, int>                  semi_files;
+  uint32_t                            next_semi_file;
+  bool                                exited;
+  uint32_t                            exit_status;
+
+  // live statistics, dumped on SIGUSR1 or every stats_interval seconds
+  string                              stats_file;
+  int                                 stats_interval;
+  vector<uint64_t>                    int_by_cause;
+  chrono::steady_clock::time_point    run_start;
+  chrono::steady_clock::time_point    last_stats_time;
+  uint64_t                            last_stats_count;
+
+  // instrumentation plugins
+  string                              plugin_spec;
+  bool                                profile_on;
+  string                              profile_file;
+  // loads and stores of current instruction, drained to plugin by step
+  vector<s_MemAccess>                 plugin_accesses;
+
+  // watchpoints
+  vector<string>                      watch_options;
+  vector<s_Watchpoint>                watchpoints;
+  bool                                stopped;
+
+  // reverse execution
+  bool                                debug_on;
+  uint64_t                            checkpoint_interval;
+  uint64_t                            checkpoint_budget;
+  uint64_t                            checkpoint_bytes;
+  uint64_t                            next_checkpoint;
+  deque<s_Checkpoint>                 checkpoints;
+  uint64_t                            inst_count;
+  int                                 intrpt;
+  bool                                halted;
+  bool                                replaying;
+  uint32_t                            track_addr;
+  uint64_t                            track_hit;
+  bool                                track_found;
+
+  // source line coverage
+  bool                                coverage_on;
+  string                              coverage_file;
+  vector<s_SrcLine>                   src_lines;
+  vector<unique_ptr<uint32_t[]>>      cov_bitmaps;
+
+  // lockstep execution of many instances
+  string                              lanes_file;
+  // <address|symbol>=<value> or <address|symbol>=@<file>, written after image is loaded
+  vector<string>                      patches;
+
+  // differential verification, 0 compares at block boundaries
+  bool                                verify_on;
+  uint64_t                            verify_interval;
+  bool                                track_dirty;
+  vector<uint32_t>                    dirty_pages;
+
 public:
   // Constructors
-  Emulator(string inFileName);
+  Emulator(string inFileName, vector<string> options = vector<string>());
   ~Emulator();
 
   // Helper functions
@@ -87,17 +582,61 @@ public:
   int string_to_val(string str);
   bool is_number(const string& str);
   void fill_memory();
-  int char_to_val(char ch);
+  void parse_options();
+  void load_symbols();
+  static string symbolize(const map<uint32_t, string> &symbols, uint32_t addr);
+  void record_access(uint32_t addr, uint8_t kind);
+  void flush_access_batch();
+  void load_line_table();
+  void write_coverage();
+
+  // Memory functions
+  s_PageEntry *find_page_entry(uint32_t addr);
+  s_PageEntry &get_page_entry(uint32_t addr);
+  bool is_written(uint32_t addr);
+  static void mark_written(s_Page *page, uint32_t addr) { page->written[(addr & _page_mask) >> 7] |= 1u << ((addr >> 2) & 31); }
+  uint8_t read_byte(uint32_t addr);
+  void write_byte(uint32_t addr, uint8_t val);
+  uint32_t read_memory(uint32_t addr);
   void set_memory(uint32_t addr, uint32_t val);
   uint32_t load_val_from_mem(uint32_t addr);
-  string uint32_t_to_string(uint32_t val);
+  void set_mem(uint32_t addr, uint32_t val);
+  uint32_t load_slow(uint32_t addr);
+  void set_mem_slow(uint32_t addr, uint32_t val);
+  uint16_t page_flags(uint32_t addr, int size);
+  s_Page *writable_page(uint32_t addr);
+  uint32_t resolve_address(string str);
+  void apply_patch(string patch);
+  void add_watchpoint(string option);
+  void check_watchpoints(uint32_t addr, uint32_t val, uint32_t old_val, int kind);
+  void print_state();
+  void start_dirty_tracking();
+  void mark_dirty(uint32_t addr);
+
+  // Devices
+  void map_devices();
+  bool is_device_reg(uint32_t addr);
+  uint32_t mmio_read(uint32_t addr);
+  void mmio_write(uint32_t addr, uint32_t val);
+  void block_command(uint32_t cmd);
+  void dma_to_memory(uint32_t addr, const uint8_t *src, uint64_t len);
+  void dma_from_memory(uint32_t addr, uint8_t *dst, uint64_t len);
+  void host_call(uint32_t call);
+  uint32_t semi_transfer(uint32_t handle, uint32_t buf, uint32_t len, bool to_host);
+  uint32_t semi_open(uint32_t path, uint32_t mode);
+  uint32_t get_exit_status() { return exit_status; }
+
+  // Statistics
+  // set only by signal handlers, polled at block boundaries
+  static volatile sig_atomic_t stats_pending;
+  void start_stats();
+  void dump_stats();
 
   // Passage instructions
   void decode_pc_instruction();
   uint32_t push_reg(int regNo, bool ctrl_regs = false);
   void set_reg(int regNo, uint32_t val, bool ctrl_regs = false);
   uint32_t set_reg_from_mem(int regNo, uint32_t addr, bool ctrl_regs = false);
-  void set_mem(uint32_t addr, uint32_t val);
   void do_halt();
   void do_int(int &intrpt);
   void do_call();
@@ -108,9 +647,81 @@ public:
   void do_shift();
   void do_store();
   void do_load(int &intrpt);
+  uint32_t read_csr(int regNo);
+  void check_csr_write(int regNo);
+
+  // Interrupt instructions
+  void raise_interrupt(int cause);
+  void handle_pending_interrupts(int &intrpt);
+  void enter_interrupt(int cause, int &intrpt);
+  uint32_t interrupt_target(int cause);
+
+  // Reverse execution
+  void take_checkpoint();
+  void save_page(uint32_t addr);
+  void restore_checkpoint(int index);
+  void replay_to(uint64_t target);
+  void reverse_to_write(uint32_t addr);
+  template<typename Timing> void forward(Timing &timing, uint64_t count);
+  template<typename Timing> void debug_loop(Timing &timing);
 
   // Functions
   void pass();
+  template<typename Timing, typename Plugin> void step(Timing &timing, Plugin &plugin);
+  template<typename Timing> void step(Timing &timing);
+  template<typename Timing, typename Plugin> void run(Timing &timing, Plugin &plugin);
+  template<typename Timing> void run_with_plugin(Timing &timing);
+  template<typename Timing, typename Plugin> void run_and_finish(Timing &timing, Plugin &plugin);
+};
+
+
+// Runs one image as K lanes in lockstep. General purpose registers are kept as K wide rows so
+// aritmetic, logic and shift instructions run over all lanes at once, every other instruction
+// goes through scalar step of lane's own emulator. Lane that ends up on different pc (or
+// different instruction word) drops out of the group and later runs alone.
+class Lockstep {
+  friend class Verifier;
+private:
+  vector<unique_ptr<Emulator>>        lanes;
+  int                                 num_lanes;
+  // register r of lane k is at [r * num_lanes + k]
+  vector<uint32_t>                    regs;
+  uint32_t                            pc;
+  // lanes still in the group, lanes[active[0]] decodes
+  vector<int>                         active;
+  vector<bool>                        halted;
+  // message of exception that stopped lane, printed in lane order
+  vector<string>                      errors;
+
+public:
+  Lockstep(string inFileName, vector<string> options, const vector<string> &lanePatches, const Emulator &ref);
+
+  static vector<string> read_lanes(string lanesFile);
+  // rows of lane to its emulator, sync_to_lane also sets group pc
+  void regs_to_lane(int lane);
+  void sync_to_lane(int lane);
+  void drop_lane(int lane);
+  bool vector_op(Emulator &lead);
+  template<typename Op> void lanes_op(int regA, int regB, int regC, Op op);
+  bool step_group();
+  void report();
+  void run();
+};
+
+
+// runs reference interpreter and alternate engine on same image, stops on first difference
+class Verifier {
+private:
+  Emulator                            &ref;
+  Lockstep                            alt;
+  uint64_t                            interval;
+
+public:
+  Verifier(Emulator &ref, vector<string> options, uint64_t interval);
+
+  uint32_t alt_reg(int regNo);
+  bool compare(uint32_t inst_pc);
+  void run();
 };
 
 
@@ -15,10 +15,31 @@
 #include <algorithm>
 #include <iomanip>
 #include <set>
+#include <array>
+#include <deque>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <tuple>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace std;
 
 #define MIN_CMD_ARGS 5
+// end of address space, and limit for sections placed without -place
+#define ADDRESS_SPACE_END 0x100000000ull
+#define AUTO_PLACE_LIMIT INT32_MAX
+// pc of emulator after reset, section placed there is root of --gc-sections
+#define START_ADDRESS 0x40000000
+// first bytes of incremental link cache, changed with its format
+#define CACHE_MAGIC "LDCACHE1"
 
 struct s_FileStruct {
   s_ELFHdr                hdr;
@@ -30,62 +51,273 @@ struct s_FileStruct {
   map<int, uint8_t>       sec_content;
 };
 
+// Line table entry of merged section, address is known only after sections are placed
+struct s_LineInfo {
+  int                     sec_ndx;
+  uint32_t                offset;
+  uint32_t                line;
+  string                  file;
+
+  s_LineInfo(int sec_ndx = 0, uint32_t offset = 0, uint32_t line = 0, string file = "") : sec_ndx(sec_ndx), offset(offset), line(line), file(file) { }
+};
+
+// Bounded view of bytes of mapped input file, every read is checked against the view, so
+// corrupted offsets and sizes in headers can't reach outside of the file
+struct s_ByteView {
+  const char              *data;
+  size_t                  size;
+
+  s_ByteView(const char *data = nullptr, size_t size = 0) : data(data), size(size) { }
+  s_ByteView sub(uint64_t pos, uint64_t len) const {
+    if(pos > size || len > size - pos)
+      throw CustomException("*LE : Input file table is out of file bounds");
+    return s_ByteView(data + pos, len);
+  }
+  uint64_t read(size_t pos, int len) const {
+    uint64_t temp = 0;
+    if(pos > size || len > size - pos)
+      throw CustomException("*LE : Tried to read over table boundary");
+    memcpy(&temp, data + pos, len);
+    return temp;
+  }
+};
+
+// Object file mapped once read only, headers and tables are parsed in place
+class MappedFile {
+private:
+  int                     fd;
+  void                    *mapping;
+  size_t                  length;
+
+public:
+  MappedFile(string fileName);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  s_ByteView view() const { return s_ByteView(static_cast<const char *>(mapping), length); }
+};
+
+// Tables of one input file, parsed on worker thread without touching tables of linker
+struct s_InputTables {
+  vector<s_SHdr>              hdrTbl;
+  s_ByteView                  secString;
+  s_ByteView                  symString;
+  vector<s_SSym>              symTab;
+  // relocations of every SHT_RELA section, by its index in header table
+  map<int, vector<s_Rela>>    rela;
+};
+
+// Static archive from command line, mapped once. Symbol index is looked up in place, so only
+// index entries and members that are used are read.
+struct s_Archive {
+  string                      name;
+  unique_ptr<MappedFile>      file;
+  s_ByteView                  members;
+  s_ByteView                  symbols;
+  s_ByteView                  buckets;
+  s_ByteView                  strings;
+  uint32_t                    num_members;
+  uint32_t                    num_symbols;
+  uint32_t                    num_buckets;
+  // members already pulled into link
+  vector<char>                extracted;
+};
+
+// Symbol of input file as merge saw it, new version of file must declare same symbols
+struct s_SymSig {
+  int                         sym;
+  int                         sec;
+  unsigned char               bind;
+  unsigned char               type;
+  uint64_t                    size;
+
+  bool operator==(const s_SymSig &other) const {
+    return sym == other.sym && sec == other.sec && bind == other.bind && type == other.type && size == other.size;
+  }
+};
+
+// What input file contributed to the link, kept in incremental cache. Changed file can take place
+// of its old version only when it has same sections of same sizes and same symbols.
+struct s_FileInfo {
+  uint64_t                    hash;
+  // merged section and input header of every part, in header order
+  vector<pair<int, s_SHdr>>   parts;
+  // offset of part in merged section
+  map<int, uint64_t>          sec_base;
+  vector<s_SymSig>            syms;
+  // relocations and line entries of file follow ones of previous files in merged tables
+  map<int, uint64_t>          reloc_count;
+  uint64_t                    line_count;
+
+  s_FileInfo() : hash(0), line_count(0) { }
+};
+
+// Literal pool at end of part of mergeable section, with instructions reading it. Offsets are
+// relative to the part.
+struct s_LitPool {
+  int                         file;
+  int                         sec_ndx;
+  uint32_t                    start;
+  vector<s_PoolRef>           refs;
+};
+
+// Free parts of address space as disjoint intervals [start, end), sections are carved out of them.
+// First fit takes lowest address where section fits, best fit the smallest free interval it fits in.
+class AddressSpace {
+private:
+  map<uint64_t, uint64_t>             free_ranges;
+  // (length, start) of every free interval, for best fit
+  set<pair<uint64_t, uint64_t>>       by_length;
+
+  void add_range(uint64_t start, uint64_t end);
+  void take(map<uint64_t, uint64_t>::iterator range, uint64_t start, uint64_t size);
+
+public:
+  AddressSpace(uint64_t start, uint64_t end) { add_range(start, end); }
+
+  // takes exactly [addr, addr + size), false if part of it is not free
+  bool reserve(uint64_t addr, uint64_t size);
+  // aligned place below limit, false if there is none
+  bool allocate(uint64_t size, uint64_t align, uint64_t limit, bool best_fit, uint64_t &addr);
+};
+
+// Interned names. Id is index of the name in order of adding, so it matches index of symbol
+// in symbol table or of section in section table, hash index gives id of a name.
+class NameTable {
+private:
+  // deque keeps strings in place, views in index point to them
+  deque<string>                       names;
+  unordered_map<string_view, int>     index;
+
+public:
+  int find(string_view name) const {
+    auto it = index.find(name);
+    return (it != index.end()) ? it->second : -1;
+  }
+  bool contains(string_view name) const { return index.count(name) > 0; }
+  // same as map lookup it replaces, missing name is null entry 0
+  int id(string_view name) const {
+    int ndx = find(name);
+    return (ndx >= 0) ? ndx : 0;
+  }
+  int add(string_view name) {
+    names.push_back(string(name));
+    index.insert(make_pair(string_view(names.back()), static_cast<int>(names.size() - 1)));
+    return names.size() - 1;
+  }
+  const string &name(int ndx) const {
+    static const string empty;
+    return (ndx >= 0 && ndx < names.size()) ? names[ndx] : empty;
+  }
+  int size() const { return names.size(); }
+};
+
 class Linker{
 private:
 
   string                  outFileName;
   vector<string>          inFileNames;
   ofstream                outputFile;
-  vector<ifstream>        inputFiles;
+  vector<unique_ptr<MappedFile>> inputFiles;
+  // content of every input, whole mapped object file or member inside mapped archive
+  vector<s_ByteView>      inputData;
+  vector<s_InputTables>   inputTables;
+  vector<s_Archive>       archives;
   ofstream                helperFile;
+  ofstream                symFile;
   vector<string>          address_places;
+  int                     jobs;
+  bool                    best_fit;
+  // helper .txt listing of tables, costly for large links
+  bool                    listing;
+  // drop sections not reachable from start address and keep_symbols
+  bool                    gc_sections;
+  vector<string>          keep_symbols;
+  // share equal literal pool entries of same named sections across input files
+  bool                    merge_literals;
 
   // used structures
   vector<s_SSym>                  symTbl;
-  map<string, int>                sym_name_ndx;
-  map<string, int>                sec_name_ndx;
-  map<int, vector<char>>          sec_content;
+  NameTable                       sym_names;
+  NameTable                       sec_names;
+  // content and relocations of merged sections, indexed same as sections
+  vector<vector<char>>            sec_content;
   vector<s_SHdr>                  sections;
-  map<int, vector<s_Rela>>        reloc;
-  map<string, int>                sec_address;
-  vector<uint32_t>                used_addresses;
-  map<uint32_t, uint32_t>         addr_size;
-  map<int, uint32_t>              sym_vals;
+  vector<vector<s_Rela>>          reloc;
+  map<string, uint32_t>           sec_address;
+  // (address, section) of placed sections, sorted by address
+  vector<pair<uint32_t, int>>     layout;
+  // final symbol values, indexed same as symTbl
+  vector<uint32_t>                sym_vals;
+  vector<s_LineInfo>              line_info;
+  // per input file record of merge and file that set value of each symbol, for incremental relink
+  vector<s_FileInfo>              file_info;
+  vector<int>                     sym_owner;
+  vector<s_LitPool>               lit_pools;
 
 public:
 
   // constructors
-  Linker(string outFile, vector<string> inFiles, vector<string> addr_places);
+  // jobs is number of threads loading input files, 0 for one per hardware thread
+  // best_fit chooses placement policy of sections without -place, first fit otherwise
+  // members of arFiles are linked only when they define symbol that is still undefined
+  Linker(string outFile, vector<string> inFiles, vector<string> arFiles, vector<string> addr_places, int jobs = 0, bool listing = true, bool best_fit = false);
   ~Linker();
 
   // helper functions
-  void read_file(int ndx);
-  vector<char> read_from_binary(int ndx, int chunk, uint32_t start_addr = 0);
-  size_t load_data_from_char_vect(vector<char> vect, int size, size_t start_pos);
-  vector<s_SHdr> get_section_headers(vector<char> sec_hdr_tbl, uint16_t ent_size, uint16_t num);
-  void load_sections_from_file(vector<s_SHdr> hdrTbl, vector<char> secString, int fileNdx);
-  string get_name_from_str_array(int start_ndx, vector<char> secString);
-  void load_progbits(s_SHdr secHdr, string name, int fileNdx);
-  vector<s_SSym> get_sym_tab(vector<char> sym_tbl_vect, uint16_t ent_size, uint16_t num);
-  string find_name_by_sec_ndx(int ndx);
-  string find_name_by_sym_ndx(int ndx);
-  void load_symbols(vector<s_SHdr>hdrTbl, int i, vector<char> secString, vector<s_SSym> temp_sym_tab, vector<char> symString, int fileNdx);
-  vector<s_Rela> get_rela_tab(vector<char> rela_tab_vec, uint16_t ent_size, uint16_t num);
+  template<typename Work>
+  void run_parallel(int num, Work work);
+  void parse_file(int ndx);
+  s_ByteView read_from_binary(int ndx, uint64_t chunk, uint64_t start_addr = 0);
+  vector<s_SHdr> get_section_headers(s_ByteView sec_hdr_tbl, uint16_t ent_size, uint16_t num);
+  void load_sections_from_file(int fileNdx, bool replace = false);
+  string_view get_name_from_str_array(int start_ndx, s_ByteView secString);
+  void load_progbits(const s_SHdr &secHdr, string_view name, int fileNdx, bool replace = false);
+  uint64_t part_base(int fileNdx, int secNdx);
+  uint64_t reloc_begin(int fileNdx, int secNdx);
+  uint64_t line_begin(int fileNdx);
+  vector<s_SSym> get_sym_tab(s_ByteView sym_tbl_vect, uint16_t ent_size, uint16_t num);
+  const string &find_name_by_sec_ndx(int ndx);
+  const string &find_name_by_sym_ndx(int ndx);
+  void load_symbols(const vector<s_SHdr> &hdrTbl, int i, s_ByteView secString, const vector<s_SSym> &temp_sym_tab, s_ByteView symString, int fileNdx, bool replace = false);
+  vector<s_Rela> get_rela_tab(s_ByteView rela_tab_vec, uint16_t ent_size, uint16_t num);
+  void load_archive(int arNdx);
+  bool find_in_archive(int arNdx, string_view name, uint32_t &member);
+  void extract_archive_members();
 
   // Second pass helper instructions
+  void parse_places();
   void is_input_correct();
-  uint32_t find_start_addr(int secNdx, bool &isTherePlace);
-  void insert_sorted_to_vect(vector<uint32_t> &vect, uint32_t data);
-  int find_section_start_on_addr(uint32_t addr);
-  string charToHexString(char ch);
+  void enable_gc_sections(vector<string> keep);
+  void collect_garbage();
+  void enable_merge_literals();
+  void merge_literal_pools();
+  void place_sections();
+  void resolve_symbols();
+  // relocations [begin, end) of section, with moved only ones of symbols marked in it
+  void apply_relocations(int secNdx, size_t begin, size_t end, const vector<char> *moved = nullptr);
+  void write_hex();
+  void format_hex(const vector<char> &content, uint32_t addr, string &out);
   // Linker functions
   void first_pass();
   void second_pass();
 
+  // Incremental linking, cache of previous link is kept next to output file
+  string cache_file_name();
+  bool load_cache();
+  void save_cache();
+  bool can_replace(int fileNdx);
+  void replace_file(int fileNdx);
+  bool relink(int &changed);
+
   // Printer functions 
   void print_header_table();
   void print_symbol_table();
   void print_reloc_table();
+  void print_sym_values();
+  void print_symbol_map();
+  void print_line_table();
 
 };
 
@@ -0,0 +1,32 @@
+#ifndef _PLUGIN_HPP
+#define _PLUGIN_HPP
+
+#include <cstdint>
+
+// Interface of instrumentation plugins loaded at runtime with emu -plugin=<file.so>[:<args>].
+// Shared object exports emu_plugin_init, which fills hooks it needs (others stay null) and
+// returns 0, anything else refuses loading. ctx is passed back to every hook.
+//
+//   g++ -shared -fPIC -o tool.so tool.cpp
+
+extern "C" {
+
+struct s_PluginHooks {
+  void                  *ctx;
+  void                  (*retire)(void *ctx, uint32_t pc, char oc, char mod);
+  void                  (*mem_read)(void *ctx, uint32_t pc, uint32_t addr, uint32_t val);
+  void                  (*mem_write)(void *ctx, uint32_t pc, uint32_t addr, uint32_t val);
+  void                  (*branch)(void *ctx, uint32_t from, uint32_t to);
+  void                  (*interrupt)(void *ctx, uint32_t cause, uint32_t handler);
+  void                  (*halt)(void *ctx, uint32_t pc);
+  // called once after emulation ends, place for reports and cleanup of ctx
+  void                  (*finish)(void *ctx);
+};
+
+typedef int (*emu_plugin_init_t)(s_PluginHooks *hooks, const char *args);
+
+}
+
+#define EMU_PLUGIN_INIT "emu_plugin_init"
+
+#endif
@@ -126,9 +126,20 @@ struct s_ELFHdr {
 #define SHT_NOBITS 8 /* Program space with no data (bss) */
 #define SHT_REL 9 /* Relocation entries, no addends */
 #define SHT_HDRTAB 10 /* SEction header table */
+#define SHT_LINES 11 /* Source line table, sh_link is described section, sh_info is offset of source file name in section string table */
+#define SHT_POOL 12 /* Literal pool references, sh_link is described section, sh_info is offset of literal pool at its end */
 
 const std::string e_SHT [] {"SHT_NULL", "SHT_PROGBITS", "SHT_SYMTAB", "SHT_STRTAB", "SHT_RELA", "SHT_DYNAMIC", "SHT_NOTE", "SHT_NOBITS", "SHT_REL", "SHT_HDRTAB"} ;
 
+// Sec flags
+#define SEC_FLAGS_WRITE (1 << 0) /* Writable */
+#define SEC_FLAGS_ALLOC (1 << 1) /* Occupies memory during execution */
+#define SEC_FLAGS_EXECINSTR (1 << 2) /* Executable */
+#define SEC_FLAGS_MERGE (1 << 4) /* Might be merged */
+#define SEC_FLAGS_STRINGS (1 << 5) /* Contains nul-terminated strings */
+#define SEC_FLAGS_INFO_LINK (1 << 6) /* 'sh_info' contains SHT index */
+#define SEC_FLAGS_GROUP (1 << 9) /* Section is member of a group. */
+
 struct s_SHdr {
   // Number of the section
   uint32_t              sh_ndx;
@@ -192,6 +203,25 @@ struct s_SSym {
 };
 
 
+// One line table entry, code at offset of described section was generated from line of source file
+struct s_LineEnt {
+  uint32_t              le_offset;
+  uint32_t              le_line;
+
+  s_LineEnt(uint32_t offset, uint32_t line) : le_offset(offset), le_line(line) { }
+};
+
+
+// One literal pool reference, instruction at offset of described section reads pool entry through
+// 12 bit displacement from pc
+struct s_PoolRef {
+  uint32_t              pr_offset;
+  uint32_t              pr_entry;
+
+  s_PoolRef(uint32_t offset, uint32_t entry) : pr_offset(offset), pr_entry(entry) { }
+};
+
+
 // One relocation entry
 struct s_Rela {
   // Offset to location where correction needs to be done
@@ -208,4 +238,55 @@ struct s_Rela {
 
   s_Rela(uint64_t offset, uint64_t symval, uint32_t type, uint64_t addend, uint32_t size) : r_offset(offset), r_type(type), r_symval(symval), r_addend(addend), r_size(size) { }
 };
+
+
+// Static archive : header, member table, symbol index, string table with member and symbol names, then
+// member objects as they are. Index is hash table over global symbols defined by members, so linker
+// looks up undefined symbol without reading the rest of archive.
+#define AR_MAGIC "SSARCH01"
+#define AR_MAGIC_SIZE 8
+// end of bucket chain
+#define AR_NO_SYM 0xffffffff
+
+struct s_ArHdr {
+  char                  ar_magic[AR_MAGIC_SIZE];
+  uint32_t              ar_members;
+  uint32_t              ar_symbols;
+  // Number of hash buckets, power of two
+  uint32_t              ar_buckets;
+  uint32_t              ar_reserved;
+  // Offsets from start of archive of member table, symbol index, buckets and string table
+  uint64_t              ar_memoff;
+  uint64_t              ar_symoff;
+  uint64_t              ar_bucketoff;
+  uint64_t              ar_stroff;
+  uint64_t              ar_strsize;
+};
+
+struct s_ArMember {
+  // Offset in archive string table
+  uint32_t              am_name;
+  uint32_t              am_reserved;
+  // Object file of member
+  uint64_t              am_offset;
+  uint64_t              am_size;
+};
+
+struct s_ArSym {
+  uint64_t              as_hash;
+  // Offset in archive string table
+  uint32_t              as_name;
+  // Member defining the symbol
+  uint32_t              as_member;
+  // Next symbol in same bucket, AR_NO_SYM at the end
+  uint32_t              as_next;
+  uint32_t              as_reserved;
+};
+
+// FNV-1a of symbol name, used for buckets of archive index
+inline uint64_t ar_hash(const char *name, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for(size_t i = 0; i < len; i++) hash = (hash ^ static_cast<unsigned char>(name[i])) * 0x100000001b3ull;
+  return hash;
+}
 #endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <cstring>
+
+#include "../inc/plugin.hpp"
+
+// Example runtime plugin, counts retired instructions per opcode, taken branches, loads, stores
+// and interrupts, and prints them when emulation ends. Same counts as built in -profile.
+//
+//   g++ -shared -fPIC -o inst_profile.so plugins/inst_profile.cpp
+//   emu -plugin=inst_profile.so[:<output file>] program.hex
+
+struct s_Profile {
+  uint64_t              per_oc[16];
+  uint64_t              branches;
+  uint64_t              loads;
+  uint64_t              stores;
+  uint64_t              interrupts;
+  FILE                  *out;
+};
+
+static const char *oc_names[] = {"halt", "int", "call", "jmp", "xchg", "aritm", "logic", "shift", "store", "load"};
+
+static void on_retire(void *ctx, uint32_t, char oc, char) {
+  s_Profile *p = static_cast<s_Profile *>(ctx);
+  p->per_oc[(oc <= '9') ? (oc - '0') : ((oc | 0x20) - 'a' + 10) & 0xf]++;
+}
+
+static void on_mem_read(void *ctx, uint32_t, uint32_t, uint32_t) {
+  static_cast<s_Profile *>(ctx)->loads++;
+}
+
+static void on_mem_write(void *ctx, uint32_t, uint32_t, uint32_t) {
+  static_cast<s_Profile *>(ctx)->stores++;
+}
+
+static void on_branch(void *ctx, uint32_t, uint32_t) {
+  static_cast<s_Profile *>(ctx)->branches++;
+}
+
+static void on_interrupt(void *ctx, uint32_t, uint32_t) {
+  static_cast<s_Profile *>(ctx)->interrupts++;
+}
+
+static void on_finish(void *ctx) {
+  s_Profile *p = static_cast<s_Profile *>(ctx);
+  fprintf(p->out, "------------------------------------------------------------------\n");
+  fprintf(p->out, "Instruction profile\n");
+  for(int i = 0; i < 10; i++)
+    if(p->per_oc[i] != 0)
+      fprintf(p->out, "%10llu  %s\n", static_cast<unsigned long long>(p->per_oc[i]), oc_names[i]);
+  fprintf(p->out, "%10llu  taken branches\n", static_cast<unsigned long long>(p->branches));
+  fprintf(p->out, "%10llu  loads\n", static_cast<unsigned long long>(p->loads));
+  fprintf(p->out, "%10llu  stores\n", static_cast<unsigned long long>(p->stores));
+  fprintf(p->out, "%10llu  interrupts\n", static_cast<unsigned long long>(p->interrupts));
+  if(p->out != stdout)
+    fclose(p->out);
+  delete p;
+}
+
+extern "C" int emu_plugin_init(s_PluginHooks *hooks, const char *args) {
+  s_Profile *p = new s_Profile();
+  memset(p, 0, sizeof(*p));
+  p->out = (args[0] != '\0') ? fopen(args, "w") : stdout;
+  if(p->out == nullptr) {
+    delete p;
+    return 1;
+  }
+  hooks->ctx = p;
+  hooks->retire = on_retire;
+  hooks->mem_read = on_mem_read;
+  hooks->mem_write = on_mem_write;
+  hooks->branch = on_branch;
+  hooks->interrupt = on_interrupt;
+  hooks->finish = on_finish;
+  return 0;
+}
@@ -0,0 +1,174 @@
+#include "../inc/archiver.hpp"
+
+
+Archiver::Archiver(string outFile) : outFileName(outFile) {
+}
+
+
+uint64_t Archiver::read(const vector<char> &content, uint64_t pos, int len) {
+  uint64_t temp = 0;
+  if(pos > content.size() || len > content.size() - pos)
+    throw CustomException("*AE : Input file table is out of file bounds");
+  memcpy(&temp, content.data() + pos, len);
+  return temp;
+}
+
+
+// Reads object file and collects global symbols it defines, object itself goes into archive unchanged
+void Archiver::add_member(string fileName) {
+  ifstream inFile(fileName, ios::in | ios::binary);
+  if(!inFile.is_open())
+    throw CustomException("*AE : Failed to open input file");
+  s_ArInput member;
+  member.content.assign(istreambuf_iterator<char>(inFile), istreambuf_iterator<char>());
+  member.name = fileName.substr(fileName.find_last_of('/') + 1);
+  const vector<char> &content = member.content;
+  if(content.size() < sizeof(s_ELFHdr))
+    throw CustomException("*AE : Input file is too small to be object file");
+
+  uint64_t shoff = read(content, offsetof(s_ELFHdr, e_shoff), sizeof(uint64_t));
+  uint64_t shentsize = read(content, offsetof(s_ELFHdr, e_shentsize), sizeof(uint16_t));
+  uint64_t shnum = read(content, offsetof(s_ELFHdr, e_shnum), sizeof(uint16_t));
+  for(uint64_t i = 0; i < shnum; i++) {
+    uint64_t hdr = shoff + i * shentsize;
+    if(read(content, hdr + offsetof(s_SHdr, sh_type), sizeof(uint32_t)) != SHT_SYMTAB)
+      continue;
+    uint64_t symoff = read(content, hdr + offsetof(s_SHdr, sh_offset), sizeof(uint64_t));
+    uint64_t symsize = read(content, hdr + offsetof(s_SHdr, sh_size), sizeof(uint64_t));
+    uint64_t entsize = read(content, hdr + offsetof(s_SHdr, sh_entsize), sizeof(uint64_t));
+    uint64_t link = read(content, hdr + offsetof(s_SHdr, sh_link), sizeof(uint32_t));
+    if(entsize == 0 || link >= shnum)
+      throw CustomException("*AE : Malformed section header in input file");
+    uint64_t strhdr = shoff + link * shentsize;
+    uint64_t stroff = read(content, strhdr + offsetof(s_SHdr, sh_offset), sizeof(uint64_t));
+    uint64_t strsize = read(content, strhdr + offsetof(s_SHdr, sh_size), sizeof(uint64_t));
+    if(stroff > content.size() || strsize > content.size() - stroff)
+      throw CustomException("*AE : Input file table is out of file bounds");
+    for(uint64_t j = 0; j < symsize / entsize; j++) {
+      uint64_t sym = symoff + j * entsize;
+      uint64_t name = read(content, sym + offsetof(s_SSym, sym_name), sizeof(uint32_t));
+      uint64_t type = read(content, sym + offsetof(s_SSym, sym_type), sizeof(unsigned char));
+      uint64_t bind = read(content, sym + offsetof(s_SSym, sym_bind), sizeof(unsigned char));
+      uint64_t ndx = read(content, sym + offsetof(s_SSym, sym_ndx), sizeof(uint16_t));
+      if(bind != STB_GLOBAL || type == STT_SECTION || ndx == 0 || name >= strsize)
+        continue;
+      const char *start = content.data() + stroff + name;
+      string symName(start, strnlen(start, strsize - name));
+      auto defined = index.find(symName);
+      if(defined != index.end()) {
+        cout << "Symbol : " << symName << " of " << member.name << " is already defined in " << members[defined->second].name << ", first definition is used" << endl;
+        continue;
+      }
+      index[symName] = members.size();
+      member.defined.push_back(symName);
+    }
+  }
+  members.push_back(move(member));
+}
+
+
+// Tables are written in order of header fields, then members each aligned to 8 bytes
+void Archiver::write_archive() {
+  vector<char> strings;
+  auto add_string = [&strings](const string &str) {
+    uint32_t offset = strings.size();
+    strings.insert(strings.end(), str.begin(), str.end());
+    strings.push_back('\0');
+    return offset;
+  };
+
+  vector<s_ArMember> memTbl(members.size());
+  vector<s_ArSym> symTbl;
+  for(uint32_t i = 0; i < members.size(); i++) {
+    memTbl[i].am_name = add_string(members[i].name);
+    memTbl[i].am_reserved = 0;
+    memTbl[i].am_size = members[i].content.size();
+    for(auto& name : members[i].defined) {
+      s_ArSym sym;
+      sym.as_hash = ar_hash(name.data(), name.size());
+      sym.as_name = add_string(name);
+      sym.as_member = i;
+      sym.as_next = AR_NO_SYM;
+      sym.as_reserved = 0;
+      symTbl.push_back(sym);
+    }
+  }
+
+  uint32_t buckets = 1;
+  while(buckets < symTbl.size())
+    buckets <<= 1;
+  vector<uint32_t> bucketTbl(buckets, AR_NO_SYM);
+  // chains are built from the back, so they keep order of symbols
+  for(uint32_t i = symTbl.size(); i-- > 0; ) {
+    uint32_t &head = bucketTbl[symTbl[i].as_hash & (buckets - 1)];
+    symTbl[i].as_next = head;
+    head = i;
+  }
+
+  s_ArHdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.ar_magic, AR_MAGIC, AR_MAGIC_SIZE);
+  hdr.ar_members = memTbl.size();
+  hdr.ar_symbols = symTbl.size();
+  hdr.ar_buckets = buckets;
+  hdr.ar_memoff = sizeof(s_ArHdr);
+  hdr.ar_symoff = hdr.ar_memoff + memTbl.size() * sizeof(s_ArMember);
+  hdr.ar_bucketoff = hdr.ar_symoff + symTbl.size() * sizeof(s_ArSym);
+  hdr.ar_stroff = hdr.ar_bucketoff + bucketTbl.size() * sizeof(uint32_t);
+  hdr.ar_strsize = strings.size();
+  uint64_t offset = hdr.ar_stroff + hdr.ar_strsize;
+  for(auto& member : memTbl) {
+    offset = (offset + 7) & ~7ull;
+    member.am_offset = offset;
+    offset += member.am_size;
+  }
+
+  ofstream outFile(outFileName, ios::out | ios::trunc | ios::binary);
+  if(!outFile.is_open())
+    throw CustomException("*AE : Failed to open output file");
+  outFile.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+  outFile.write(reinterpret_cast<const char*>(memTbl.data()), memTbl.size() * sizeof(s_ArMember));
+  outFile.write(reinterpret_cast<const char*>(symTbl.data()), symTbl.size() * sizeof(s_ArSym));
+  outFile.write(reinterpret_cast<const char*>(bucketTbl.data()), bucketTbl.size() * sizeof(uint32_t));
+  outFile.write(strings.data(), strings.size());
+  uint64_t written = hdr.ar_stroff + hdr.ar_strsize;
+  const char zero[8] = {};
+  for(uint32_t i = 0; i < members.size(); i++) {
+    outFile.write(zero, memTbl[i].am_offset - written);
+    outFile.write(members[i].content.data(), members[i].content.size());
+    written = memTbl[i].am_offset + memTbl[i].am_size;
+  }
+  outFile.close();
+  if(!outFile)
+    throw CustomException("*AE : Failed to write archive");
+}
+
+
+int main(int argc, char const *argv[]) {
+  try {
+    // ar -o lib.a file.o ...
+    if(argc < MIN_CMD_ARGS)
+      throw CustomException("*AE : Not enough arguments provided");
+    if(string(argv[1]) != "-o")
+      throw CustomException("*AE : -o option not specified");
+    string outFile = argv[2];
+    if(outFile.length() < 2 || outFile.substr(outFile.length() - 2) != ".a")
+      throw CustomException("*AE : Output file doesn't have .a suffix");
+
+    Archiver ar(outFile);
+    for(int i = 3; i < argc; i++) {
+      string inFile = argv[i];
+      if(inFile.length() < 2 || inFile.substr(inFile.length() - 2) != ".o")
+        throw CustomException("*AE : You must pass only object files (.o)");
+      ar.add_member(inFile);
+    }
+    ar.write_archive();
+
+    cout << "Archiving to " << outFile << " done" << endl;
+
+  } catch(const std::exception &e){
+    cerr << e.what() << endl;
+  }
+
+  return 0;
+}
@@ -1,7 +1,7 @@
 
 #include "../inc/assembler.hpp"
 
-Assembler::Assembler(string outFile, string inFile) : outFile(outFile), inFile(inFile) {
+Assembler::Assembler(string outFile, string inFile, bool lineTable) : outFile(outFile), inFile(inFile), lineTableOn(lineTable) {
   // opening of provided files
   string tempInFile = inFile;
   inputFile.open(tempInFile, ios::in);
@@ -14,6 +14,7 @@ Assembler::Assembler(string outFile, string inFile) : outFile(outFile), inFile(i
       if(!inputFile.is_open()) throw CustomException("*E : Input file is not open");
     }
   }
+  srcFile = tempInFile;
   outputFile.open(outFile, ios::binary | ios::trunc);
   if(!outputFile.is_open()) throw CustomException("*E : Output file is not open");
 
@@ -62,8 +63,10 @@ void Assembler::first_pass() {
   if(inputFile.is_open()) {
     string line;
     int i = 0;
+    int srcLine = 0;
     bool isEnd = false;
     while(getline(inputFile, line) && !isEnd){
+      srcLine++;
       // Deleting all comments
       line = line.substr(0, line.find(COMMENT_DELIMETER));
       int pos = line.find_first_not_of(SPACE_CHAR);
@@ -71,6 +74,7 @@ void Assembler::first_pass() {
       if(!line.empty()) {
         s_LineStruct tempStruct;
         tempStruct.line = line;
+        tempStruct.src_line = srcLine;
         if(line[0] == DIRECTIVE_START_CHAR) {
           tempStruct.type = DIRECTIVE;
           // handle directive
@@ -232,6 +236,8 @@ bool Assembler::handle_directive_second_pass(s_LineStruct& line){
 
 void Assembler::handle_instruction_second_pass(s_LineStruct& line) {
   if(sec_content.count(currSecIndex) < 0) throw CustomException ("*E : Current section does not have its map for storing data");
+  if(lineTableOn)
+    line_table[currSecIndex].push_back(s_LineEnt(locationCounter, line.src_line));
   if(line.info == __INST_HALT || line.info == __INST_INT) {
           locationCounter += WORD_SIZE;
     uint32_t opcode = instruction_map.at(line.info).opcode;
@@ -267,6 +273,7 @@ void Assembler::handle_instruction_second_pass(s_LineStruct& line) {
       else if (index_of_l == -2)
         throw CustomException("*I : Illegal operand type for call/jmp");
       uint32_t displacement = index_of_l * WORD_SIZE + (secHdrTbl[currSecIndex].sec_size - locationCounter);
+      add_pool_ref(locationCounter - WORD_SIZE, index_of_l);
       // 0010 - mmmm - aaaa - bbbb - cccc - dddd - dddd - dddd
       // MMMM==0b1001: if (gpr[B] == gpr[C]) pc<=mem32[gpr[A]+D];
       // MMMM==0b1010: if (gpr[B] != gpr[C]) pc<=mem32[gpr[A]+D];  
@@ -390,20 +397,17 @@ void Assembler::handle_instruction_second_pass(s_LineStruct& line) {
       if(line.operands[1] == "pc") throw CustomException("*I : Tried to alter PC via csr operation");
       if(line.operands[0][0] != __REG_INDICATOR) throw CustomException("*E : No register start indicator '%' for csr register");
       string csr_reg = line.operands[0].substr(1);
-      if(csr_reg == "handler") csr = __REG_HANDLER;
-      else if (csr_reg == "status") csr = __REG_STATUS;
-      else if (csr_reg == "cause") csr = __REG_CAUSE;
-      else throw CustomException("*E : Bad name for csr register");
+      if(csr_map.count(csr_reg) <= 0) throw CustomException("*E : Bad name for csr register");
+      csr = csr_map.at(csr_reg);
     } else {
       if(line.operands[1][0] != __REG_INDICATOR) throw CustomException("*E : No register start indicator '%' for csr register");
       string csr_reg = line.operands[1].substr(1);
-      if(csr_reg == "handler") csr = __REG_HANDLER;
-      else if (csr_reg == "status") csr = __REG_STATUS;
-      else if (csr_reg == "cause") csr = __REG_CAUSE;
-      else throw CustomException("*E : Bad name for csr register");
+      if(csr_map.count(csr_reg) <= 0) throw CustomException("*E : Bad name for csr register");
+      csr = csr_map.at(csr_reg);
+      if(csr >= __REG_CYCLE) throw CustomException("*E : Counter csr registers are read only");
     }
     uint8_t gprD = get_reg(line.operands[1]);
-    if(gpr >= 0 && gpr <= 15 && csr >= 0 && csr <= 2)
+    if(gpr >= 0 && gpr <= 15 && csr >= 0 && csr <= __REG_INTCNT)
       gpr_csr(gpr, csr, line.info);
     else 
       throw CustomException("*E : Wrong operands for csr operation");
@@ -573,6 +577,7 @@ void Assembler::load_instr(string op0, string op1){
         if(op_type == "S" && !check_sym_in_tbl(op0.substr(1)))
           symTable.push_back(s_Sym(op0.substr(1), GLOBAL, NOTYPE, 0, 0));
         uint32_t displacement = (index_of_l-1) * WORD_SIZE + (secHdrTbl[currSecIndex].sec_size - locationCounter);
+        add_pool_ref(locationCounter, index_of_l);
         ld_mem_reg(reg, __PC, displacement);
       } else if (op_type == "ML" || op_type == "MS") {
         int index_of_l = (op_type == "ML") ? get_index_of_literal_for_section(string_to_val(op0)) : get_index_of_literal_for_section(op0);
@@ -581,6 +586,7 @@ void Assembler::load_instr(string op0, string op1){
         if(op_type == "MS" && !check_sym_in_tbl(op0))
           symTable.push_back(s_Sym(op0, GLOBAL, NOTYPE, 0, 0));
         uint32_t displacement = (index_of_l - 1) * WORD_SIZE + (secHdrTbl[currSecIndex].sec_size - locationCounter);
+        add_pool_ref(locationCounter, index_of_l);
         ld_mem_reg(reg, __PC, displacement);
         ld_mem_reg(reg, reg, 0);
       } else if (op_type == "R") {
@@ -661,6 +667,7 @@ void Assembler::store_instr(string op0, string op1){
         if(op_type == "S" && !check_sym_in_tbl(op1.substr(1)))
           symTable.push_back(s_Sym(op1.substr(1), GLOBAL, NOTYPE, 0, 0));
         uint32_t displacement = index_of_l * WORD_SIZE + (secHdrTbl[currSecIndex].sec_size - locationCounter);
+        add_pool_ref(locationCounter - WORD_SIZE, index_of_l);
 
         opcode = store(reg, __PC, displacement, __ST_MEM);
       } else if (op_type == "R") {
@@ -683,6 +690,7 @@ void Assembler::store_instr(string op0, string op1){
         if(op_type == "MS" && !check_sym_in_tbl(op1))
           symTable.push_back(s_Sym(op1, GLOBAL, NOTYPE, 0, 0));
         uint32_t displacement = index_of_l * WORD_SIZE + (secHdrTbl[currSecIndex].sec_size - locationCounter);
+        add_pool_ref(locationCounter - WORD_SIZE, index_of_l);
 
         opcode = store(reg, __PC, displacement, __ST_MEM_MEM);
       } else if (op_type == "RL") {
@@ -777,6 +785,7 @@ void Assembler::jmp_call(string operand, string op){
   else if (index_of_l == -2)
     throw CustomException("*I : Illegal operand type for call/jmp");
   uint32_t displacement = index_of_l * WORD_SIZE + (secHdrTbl[currSecIndex].sec_size - locationCounter);
+  add_pool_ref(locationCounter - WORD_SIZE, index_of_l);
 
   // 0010 - mmmm - aaaa - bbbb - 0000 - dddd - dddd - dddd
   // CALL : push pc; pc<=mem32[gpr[A]+gpr[B]+D];
@@ -977,6 +986,8 @@ uint8_t Assembler::get_reg(string op) {
     return __REG_STATUS;
   if(op.substr(1) == "cause")
     return __REG_CAUSE;
+  if(csr_map.count(op.substr(1)) > 0)
+    return csr_map.at(op.substr(1));
   if(op[0] != __REG_INDICATOR) throw CustomException("*E : Operand not correct for translation to reg, missing '%' at the start");
   if(op[1] != 'r') 
     throw CustomException("*E : Operand not correct for translation to reg, missing r as indicator");
@@ -1121,6 +1132,12 @@ void Assembler::add_literal_to_pool(int lit) {
 }
 
 
+// Instruction at offset reads entry index of current section literal pool, pool starts at end of section
+void Assembler::add_pool_ref(uint32_t offset, int index) {
+  pool_refs[currSecIndex].push_back(s_PoolRef(offset, secHdrTbl[currSecIndex].sec_size + index * WORD_SIZE));
+}
+
+
 void Assembler::add_symbol_to_pool(string sym){
   // if(!check_sym_in_tbl(sym))
   //   symTable.push_back(s_Sym(sym, LOCAL, NOTYPE, 0, currSecIndex));
@@ -1247,8 +1264,9 @@ void Assembler::write_to_out_file(){
   sTab.push_back(s_SSym(0, 0, 0, 0, 0, 0));
   symStringTbl.push_back(0x00);
   for(int i = 1; i < secHdrTbl.size(); i++) {
+    // section with literal pool is mergeable, linker may share equal pool entries across objects
     sections.push_back(s_SHdr(i, secStringTbl.size(), secHdrTbl[i].sec_size, SHT_PROGBITS, secHdrTbl[i].sec_addr, calc_offset_for_index(sections, i), 
-                      secHdrTbl[i].sec_flags, secHdrTbl[i].sec_link, secHdrTbl[i].sec_info, 0, 0));
+                      secHdrTbl[i].sec_flags | ((sec_literals.count(i) > 0) ? SEC_FLAGS_MERGE : 0), secHdrTbl[i].sec_link, secHdrTbl[i].sec_info, 0, 0));
     for(int j = 0; j < secHdrTbl[i].sec_name.length(); j++){
       secStringTbl.push_back(secHdrTbl[i].sec_name[j]);
     }
@@ -1302,6 +1320,27 @@ void Assembler::write_to_out_file(){
       secStringTbl.push_back(secHdrTbl[elem.first].sec_name[i]);
     secStringTbl.push_back(0x00);
   }     
+  // line table of a section is named lines.<section>, source file name follows it in string table
+  for(auto& elem : line_table) {
+    string lineSecName = "lines." + secHdrTbl[elem.first].sec_name;
+    sections.push_back(s_SHdr(sections.size(), secStringTbl.size(), (elem.second.size() * sizeof(s_LineEnt)), SHT_LINES, 0, calc_offset_for_index(sections, sections.size()), 
+                      0, elem.first, secStringTbl.size() + lineSecName.length() + 1, 0, sizeof(s_LineEnt)));
+    for(int i = 0; i < lineSecName.length(); i++)
+      secStringTbl.push_back(lineSecName[i]);
+    secStringTbl.push_back(0x00);
+    for(int i = 0; i < srcFile.length(); i++)
+      secStringTbl.push_back(srcFile[i]);
+    secStringTbl.push_back(0x00);
+  }
+  // pool reference table of a section is named pool.<section>, info holds where its literal pool begins
+  for(auto& elem : pool_refs) {
+    string poolSecName = "pool." + secHdrTbl[elem.first].sec_name;
+    sections.push_back(s_SHdr(sections.size(), secStringTbl.size(), (elem.second.size() * sizeof(s_PoolRef)), SHT_POOL, 0, calc_offset_for_index(sections, sections.size()), 
+                      0, elem.first, secHdrTbl[elem.first].sec_size, 0, sizeof(s_PoolRef)));
+    for(int i = 0; i < poolSecName.length(); i++)
+      secStringTbl.push_back(poolSecName[i]);
+    secStringTbl.push_back(0x00);
+  }
   int hdrStrBeginNdx = secStringTbl.size();
   int hdrStrNdx = sections.size();
   secStringTbl.push_back('h'); secStringTbl.push_back('d'); secStringTbl.push_back('r'); secStringTbl.push_back('S'); secStringTbl.push_back('t'); secStringTbl.push_back('r'); secStringTbl.push_back(0x00);
@@ -1419,6 +1458,20 @@ void Assembler::outputData() {
         outputFile.write(reinterpret_cast<const char*>(&reloc.at(sections[i].sh_link)[j].r_addend), sizeof(reloc.at(sections[i].sh_link)[j].r_addend));
           sz += sizeof(reloc.at(sections[i].sh_link)[j].r_addend);
       }
+    } else if (sections[i].sh_type == SHT_LINES) {
+      for(int j = 0; j < line_table.at(sections[i].sh_link).size(); j++) {
+        outputFile.write(reinterpret_cast<const char*>(&line_table.at(sections[i].sh_link)[j].le_offset), sizeof(line_table.at(sections[i].sh_link)[j].le_offset));
+          sz += sizeof(line_table.at(sections[i].sh_link)[j].le_offset);
+        outputFile.write(reinterpret_cast<const char*>(&line_table.at(sections[i].sh_link)[j].le_line), sizeof(line_table.at(sections[i].sh_link)[j].le_line));
+          sz += sizeof(line_table.at(sections[i].sh_link)[j].le_line);
+      }
+    } else if (sections[i].sh_type == SHT_POOL) {
+      for(int j = 0; j < pool_refs.at(sections[i].sh_link).size(); j++) {
+        outputFile.write(reinterpret_cast<const char*>(&pool_refs.at(sections[i].sh_link)[j].pr_offset), sizeof(pool_refs.at(sections[i].sh_link)[j].pr_offset));
+          sz += sizeof(pool_refs.at(sections[i].sh_link)[j].pr_offset);
+        outputFile.write(reinterpret_cast<const char*>(&pool_refs.at(sections[i].sh_link)[j].pr_entry), sizeof(pool_refs.at(sections[i].sh_link)[j].pr_entry));
+          sz += sizeof(pool_refs.at(sections[i].sh_link)[j].pr_entry);
+      }
     } else if (sections[i].sh_type == SHT_HDRTAB) {
       for(int j = 0; j < sections.size(); j++) {
         outputFile.write(reinterpret_cast<const char*>(&sections[j].sh_ndx), sizeof(sections[j].sh_ndx));
@@ -1483,15 +1536,23 @@ int main(int argc, char const *argv[]){
     // string opt = argv[2];
     // string oF = argv[3];
     // string iF = argv[4];
-    string opt = argv[1];
-    oF = argv[2];
-    string iF = argv[3];
+    // optional -g before -o adds source line table to object file
+    int first = 1;
+    bool lineTable = false;
+    if(num_arg == CMD_LINE_SIZE + 1) {
+      if(string(argv[1]) != "-g") throw CustomException("*E : Unknown assembler option");
+      lineTable = true;
+      first = 2;
+    }
+    string opt = argv[first];
+    oF = argv[first + 1];
+    string iF = argv[first + 2];
 
     Assembler::check_input_params(opt, oF, iF);
 
     // cout << "Read input parameters succesfully" << endl;
 
-    Assembler as(oF, iF);
+    Assembler as(oF, iF, lineTable);
 
     as.first_pass();
     as.second_pass();
@@ -3,7 +3,11 @@
 // *****************************************************************************************************
 // Constructors / destructors
 
-Emulator::Emulator(string inFileName) : inFileName(inFileName) {
+Emulator::Emulator(string inFileName, vector<string> options) : mem_flags(0), inFileName(inFileName), options(options), vectored(false), pending_irqs(0), timing_on(false), cycle_timing(nullptr), int_count(0),
+  semihost_on(false), next_semi_file(3), exited(false), exit_status(0), stats_interval(0), int_by_cause(_num_causes, 0), last_stats_count(0), profile_on(false), stopped(false),
+  debug_on(false), checkpoint_interval(0), checkpoint_budget(_default_checkpoint_budget), checkpoint_bytes(0), next_checkpoint(_no_checkpoint),
+  inst_count(0), intrpt(0), halted(false), replaying(false), track_addr(0), track_hit(0), track_found(false), coverage_on(false),
+  verify_on(false), verify_interval(0), track_dirty(false) {
   inputFile.open(inFileName, ios::in);
   if(!inputFile.is_open())
     throw CustomException("*EE : Input file not open");
@@ -13,6 +17,16 @@ Emulator::Emulator(string inFileName) : inFileName(inFileName) {
     control_regs.insert(make_pair(i, 0x00000000));
   pc = &regs.at(_pc);
   sp = &regs.at(_sp);
+  page_dir.resize(_dir_size);
+  // default priorities, higher value wins
+  irq_prio.insert(make_pair(_cause_timer, 2));
+  irq_prio.insert(make_pair(_cause_terminal, 1));
+  irq_prio.insert(make_pair(_cause_block, 1));
+  irq_mask.insert(make_pair(_cause_timer, _status_tr));
+  irq_mask.insert(make_pair(_cause_terminal, _status_tl));
+  for(int i = 0; i < 3; i++)
+    semi_files.insert(make_pair(i, i));
+  parse_options();
 }
 
 Emulator::~Emulator(){
@@ -22,11 +36,146 @@ Emulator::~Emulator(){
 // *****************************************************************************************************
 // Flow handling
 void Emulator::pass() {
+  if(!lanes_file.empty()) {
+    if(timing_on || icache || dcache || coverage_on || checkpoint_interval != 0 || !watch_options.empty() || !plugin_spec.empty() || profile_on || block || semihost_on)
+      throw CustomException("*EE : Lockstep lanes support only interrupt options");
+    load_symbols();
+    vector<string> lane_options;
+    for(int i = 0; i < options.size(); i++)
+      if(options[i].find("-lanes=") != 0)
+        lane_options.push_back(options[i]);
+    Lockstep lockstep(inFileName, lane_options, Lockstep::read_lanes(lanes_file), *this);
+    lockstep.run();
+    return;
+  }
+  if(verify_on) {
+    if(timing_on || icache || dcache || coverage_on || checkpoint_interval != 0 || !watch_options.empty() || !plugin_spec.empty() || profile_on || block || semihost_on)
+      throw CustomException("*EE : Verification supports only interrupt options");
+    load_symbols();
+    vector<string> alt_options;
+    for(int i = 0; i < options.size(); i++)
+      if(options[i].find("-verify") != 0)
+        alt_options.push_back(options[i]);
+    *pc = pc_start_addr;
+    fill_memory();
+    for(int i = 0; i < patches.size(); i++)
+      apply_patch(patches[i]);
+    Verifier verifier(*this, alt_options, verify_interval);
+    verifier.run();
+    return;
+  }
+  // nothing but debugger goes back to checkpoints
+  if(!debug_on && checkpoint_interval != 0)
+    throw CustomException("*EE : Checkpoints are used only by debugger");
+  if(debug_on && (!plugin_spec.empty() || profile_on))
+    throw CustomException("*EE : Plugins are not supported with debugger");
+  if(!plugin_spec.empty() && profile_on)
+    throw CustomException("*EE : Only one plugin can be used");
+  // replay after reverse step would repeat host side effects and get different host results
+  if(debug_on && semihost_on)
+    throw CustomException("*EE : Semihosting is not supported with debugger");
+  // host file isn't part of checkpoints, replayed transfers would see and change its later content
+  if(debug_on && block)
+    throw CustomException("*EE : Block device is not supported with debugger");
   *pc = pc_start_addr;
   fill_memory();
-  int intrpt = 0;
+  map_devices();
+  if(timing_on || icache || dcache || debug_on || !watch_options.empty() || !patches.empty())
+    load_symbols();
+  for(int i = 0; i < patches.size(); i++)
+    apply_patch(patches[i]);
+  for(int i = 0; i < watch_options.size(); i++)
+    add_watchpoint(watch_options[i]);
+  if(dcache)
+    mem_flags |= _page_trace;
+  if(coverage_on)
+    load_line_table();
+  start_stats();
+  if(timing_on) {
+    CycleTiming timing(timing_file, symbols);
+    cycle_timing = &timing;
+    run_with_plugin(timing);
+    cycle_timing = nullptr;
+    timing.report(cout);
+  } else {
+    s_NoTiming timing;
+    run_with_plugin(timing);
+  }
+  if(exited)
+    cout << "Emulated program exited with status " << dec << exit_status << endl;
+  else if(stopped)
+    print_state();
+  if(coverage_on)
+    write_coverage();
+  if(icache || dcache) {
+    flush_access_batch();
+    cout << "------------------------------------------------------------------" << endl;
+    if(icache)
+      icache->report(cout, symbols);
+    if(dcache)
+      dcache->report(cout, symbols);
+  }
+}
+
+
+template<typename Timing>
+void Emulator::run_with_plugin(Timing &timing) {
+  // built in plugins are policies, each is its own instance of run
+  if(!plugin_spec.empty()) {
+    DynamicPlugin plugin(plugin_spec);
+    run_and_finish(timing, plugin);
+  } else if(profile_on) {
+    InstProfiler profiler(profile_file);
+    run_and_finish(timing, profiler);
+  } else {
+    s_NoPlugin plugin;
+    run(timing, plugin);
+  }
+}
+
+
+template<typename Timing, typename Plugin>
+void Emulator::run_and_finish(Timing &timing, Plugin &plugin) {
+  // guest fault ends emulation too, plugin still gets to write its report
+  try {
+    run(timing, plugin);
+  } catch(...) {
+    plugin.finish();
+    throw;
+  }
+  plugin.finish();
+}
+
+
+template<typename Timing, typename Plugin>
+void Emulator::run(Timing &timing, Plugin &plugin) {
+  intrpt = 0;
+  if(plugin.wants_mem())
+    mem_flags |= _page_plugin;
+  if(checkpoint_interval != 0)
+    take_checkpoint();
+  if(debug_on) {
+    debug_loop(timing);
+    return;
+  }
   do {
+    step(timing, plugin);
+  } while(oc != '0' && !stopped);
+}
+
+
+template<typename Timing>
+void Emulator::step(Timing &timing) {
+  s_NoPlugin plugin;
+  step(timing, plugin);
+}
+
+
+template<typename Timing, typename Plugin>
+void Emulator::step(Timing &timing, Plugin &plugin) {
     // cout << " PC : " << hex << *pc << " | ";
+    uint32_t inst_pc = *pc;
+    int depth = intrpt;
     decode_pc_instruction();
     if(oc == '0')
       do_halt();
@@ -50,24 +199,49 @@ void Emulator::pass() {
       do_load(intrpt);
     else 
       throw CustomException("*EE : Unsupported instruction in emulator");
-  } while(oc != '0');
+    timing.retire(inst_pc, oc, mod);
+    if(plugin.wants_mem()) {
+      for(auto& acc : plugin_accesses)
+        if(acc.kind == _acc_read)
+          plugin.mem_read(inst_pc, acc.addr, acc.val);
+        else 
+          plugin.mem_write(inst_pc, acc.addr, acc.val);
+      plugin_accesses.clear();
+    }
+    plugin.retire(inst_pc, oc, mod);
+    if(oc == '0')
+      plugin.halt(inst_pc);
+    else if(*pc != inst_pc + WORD_SIZE) {
+      // int and return from interrupt change depth, they are not reported as branches
+      if(intrpt == depth)
+        plugin.branch(inst_pc, *pc);
+      if(stats_pending)
+        dump_stats();
+    }
+    // requests are serviced only after current instruction is done
+    if(pending_irqs != 0 && oc != '0')
+      handle_pending_interrupts(intrpt);
+    if(intrpt > depth) {
+      timing.interrupt_entry();
+      plugin.interrupt(control_regs[_cause], *pc);
+    }
+    else if(intrpt < depth)
+      timing.interrupt_exit();
+    if(++inst_count == next_checkpoint)
+      take_checkpoint();
 }
 
 
 uint32_t Emulator::push_reg(int regNo, bool ctrl_regs) {
   *sp -= WORD_SIZE;
-  if(memory.count(*sp) <= 0) {
-    memory.insert(make_pair(*sp, vector<string>()));
-    memory.at(*sp) = {"00", "00", "00", "00"};
-  }
   if(!ctrl_regs)
     if(regNo >= _r0 && regNo <= _r15)
-      set_memory(*sp, regs[regNo]);
+      set_mem(*sp, regs[regNo]);
     else 
       throw CustomException("*EE : Register index out of bounds");
   else 
     if(regNo >= _status && regNo <= _cause)
-      set_memory(*sp, control_regs[regNo]);
+      set_mem(*sp, control_regs[regNo]);
     else 
       throw CustomException("*EE : Status register index out of bounds");
   return *sp;
@@ -94,11 +268,7 @@ uint32_t Emulator::set_reg_from_mem(int regNo, uint32_t addr, bool ctrl_regs) {
     if(regNo == _r0)
       throw CustomException("*EE : Tried to write to r0");
     else if(regNo >= _r1 && regNo <= _r15) {
-      if(memory.count(addr) <= 0) {
-        // throw CustomException("*EE : Unknown data on address");
-        memory.insert(make_pair(addr, vector<string>()));
-        memory[addr] = {"00", "00", "00", "00"};
-      }
+      // unwritten memory reads as zero
       regs[regNo] = load_val_from_mem(addr);
       return regs[regNo];
     }
@@ -106,11 +276,6 @@ uint32_t Emulator::set_reg_from_mem(int regNo, uint32_t addr, bool ctrl_regs) {
       throw CustomException("*EE : Register index out of bounds");
   else 
     if(regNo >= _status && regNo <= _cause){
-      if(memory.count(addr) <= 0) {
-        // throw CustomException("*EE : Unknown data on address");
-        memory.insert(make_pair(addr, vector<string>()));
-        memory[addr] = {"00", "00", "00", "00"};
-      }
       control_regs[regNo] = load_val_from_mem(addr);
       return control_regs[regNo];
     }
@@ -119,23 +284,16 @@ uint32_t Emulator::set_reg_from_mem(int regNo, uint32_t addr, bool ctrl_regs) {
 }
 
 
-void Emulator::set_mem(uint32_t addr, uint32_t val) {
-  if(memory.count(addr) <= 0) {
-    memory.insert(make_pair(addr, vector<string>()));
-    memory.at(addr) = {"00", "00", "00", "00"};
-  }
-  memory.at(addr)[0] = uint32_t_to_string(__GET_BITS_0_7(val));
-  memory.at(addr)[1] = uint32_t_to_string(__GET_BITS_8_15(val));
-  memory.at(addr)[2] = uint32_t_to_string(__GET_BITS_16_23(val));
-  memory.at(addr)[3] = uint32_t_to_string(__GET_BITS_24_31(val));
-}
-
-
 void Emulator::do_halt() {
     // print all registers
     // cout << " | HALT" << endl;
     cout << "------------------------------------------------------------------" << endl;
     cout << "Emulated processor executed halt instruction" << endl;
+    print_state();
+}
+
+
+void Emulator::print_state() {
     cout << "Emulated processor state:" << endl;
     for(int i = 0; i < regs.size(); i++) {
       if(i%4==0 && i > 0)
@@ -148,17 +306,7 @@ void Emulator::do_halt() {
 
 
 void Emulator::do_int(int &intrpt){
-  intrpt++;
-  // push status;
-  push_reg(_status, true);
-  // push pc;
-  push_reg(_pc);
-  // cause = 4;
-  set_reg(_cause, 4, true);
-  // status = status &(~0x1);
-  control_regs.at(_status) &= ~0x1;
-  // pc = handle;
-  set_reg(_pc, control_regs.at(_handle));
+  enter_interrupt(_cause_software, intrpt);
   // cout << " | INT" << endl;
 }
 
@@ -349,7 +497,11 @@ void Emulator::do_store(){
   case '2': {
     // mem32[mem32[gprA + gprB + D]] = gprC;
     // cout << " | st mem[" << load_val_from_mem(regs.at(regA) + regs.at(regB) + disp) << "] = " << regs.at(regC) << endl;
-    set_mem(load_val_from_mem(regs.at(regA) + regs.at(regB) + disp), regs.at(regC));
+    // pointer must be written data, unlike loads into registers which read unwritten words as zero
+    uint32_t ptr = regs.at(regA) + regs.at(regB) + disp;
+    if(!is_device_reg(ptr) && (!is_written(ptr) || !is_written(ptr + WORD_SIZE - 1)))
+      throw CustomException("*EE : Unknown data on address");
+    set_mem(load_val_from_mem(ptr), regs.at(regC));
     break;
   }
   case '1': {
@@ -374,7 +526,7 @@ void Emulator::do_load(int &intrpt){
     // gprA = csrB;
     // Todo : check if valid values
     // cout << " | reg" << regA << " = " << control_regs.at(regB) << endl;
-    regs.at(regA) = control_regs.at(regB);
+    regs.at(regA) = read_csr(regB);
     break;
   }
   case '1': {
@@ -391,7 +543,7 @@ void Emulator::do_load(int &intrpt){
   }
   case '3': {
     // gprA = mem32[gprB]; gprB = gprB + D;
-    bool iret = memory.at(*pc)[3][0] == '9' && memory.at(*pc)[3][1] == '7';
+    bool iret = read_byte(*pc + 3) == 0x97;
     // cout << " | reg" << regA << " = mem[" << regs.at(regB) << "]" << endl;
     set_reg_from_mem(regA, regs.at(regB));
     // cout << " | reg" << regA << " = " << (regs.at(regB) + disp) << endl;
@@ -407,6 +559,7 @@ void Emulator::do_load(int &intrpt){
     // csrA = gprB
     // Todo : check if valid values
     // cout << " | ctrl reg" << regA << " = " << regs.at(regB) << endl;
+    check_csr_write(regA);
     control_regs.at(regA) = regs.at(regB);
     break;
   }
@@ -414,17 +567,20 @@ void Emulator::do_load(int &intrpt){
     // csrA = csrB | D;
     // Todo : check if valid values
     // cout << " | ctrl reg" << regA << " = " << (control_regs.at(regB) | disp) << endl;
-    control_regs.at(regA) = control_regs.at(regB) | disp;
+    check_csr_write(regA);
+    control_regs.at(regA) = read_csr(regB) | disp;
     break;
   }
   case '6': {
     // csrA = mem32[gprB + gprC + D];
+    check_csr_write(regA);
     // cout << " | ctrl reg" << regA << " = mem[" << (regs.at(regB) + regs.at(regC) + disp) << "]" << endl;
     set_reg(regA, (regs.at(regB) + regs.at(regC) + disp), true);
     break;
   }
   case '7': {
     // csrA = mem[gprB]; gprB = gprB + D;
+    check_csr_write(regA);
     // cout << " | ctrl reg" << regA << " = mem[" << regs.at(regB) << "]" << endl;
     set_reg_from_mem(regA, regs.at(regB), true);
     // cout << " | reg" << regA << " = " << (regs.at(regB) + disp) << endl;
@@ -438,30 +594,617 @@ void Emulator::do_load(int &intrpt){
 }
 // *****************************************************************************************************
 
+// Counters are not kept in control_regs, engine already counts retired instructions
+// and timing model counts cycles, so value is assembled only when guest reads it.
+// Instruction that reads a counter is not counted yet.
+uint32_t Emulator::read_csr(int regNo) {
+  switch (regNo){
+  case _csr_cycle:
+  case _csr_cycleh: {
+    uint64_t cycles = (cycle_timing != nullptr) ? cycle_timing->get_cycles() : inst_count * _default_inst_cycles;
+    return (regNo == _csr_cycle) ? static_cast<uint32_t>(cycles) : static_cast<uint32_t>(cycles >> 32);
+  }
+  case _csr_instret:
+    return static_cast<uint32_t>(inst_count);
+  case _csr_instreth:
+    return static_cast<uint32_t>(inst_count >> 32);
+  case _csr_intcnt:
+    return int_count;
+  default:
+    if(regNo < _status || regNo > _cause)
+      throw CustomException("*EE : Status register index out of bounds");
+    return control_regs.at(regNo);
+  }
+}
+
+
+void Emulator::check_csr_write(int regNo) {
+  if(regNo >= _csr_cycle && regNo <= _csr_intcnt)
+    throw CustomException("*EE : Counter csr registers are read only");
+  if(regNo < _status || regNo > _cause)
+    throw CustomException("*EE : Status register index out of bounds");
+}
+// *****************************************************************************************************
+
+// *****************************************************************************************************
+// Interrupt instructions
+void Emulator::raise_interrupt(int cause) {
+  if(cause <= 0 || cause >= _num_causes)
+    throw CustomException("*EE : Interrupt cause out of bounds");
+  pending_irqs |= (1 << cause);
+}
+
+
+void Emulator::handle_pending_interrupts(int &intrpt) {
+  uint32_t status = control_regs.at(_status);
+  if(status & _status_i)
+    return;
+  int cpl = (status & _status_cpl_mask) >> _status_cpl_shift;
+  int best = -1;
+  for(int cause = 1; cause < _num_causes; cause++) {
+    if((pending_irqs & (1 << cause)) == 0)
+      continue;
+    if(irq_mask.count(cause) > 0 && (status & irq_mask.at(cause)))
+      continue;
+    // in vectored mode only a source with higher priority than the running one can preempt it
+    if(vectored && irq_prio[cause] <= cpl)
+      continue;
+    if(best < 0 || irq_prio[cause] > irq_prio[best])
+      best = cause;
+  }
+  if(best < 0)
+    return;
+  pending_irqs &= ~(1 << best);
+  enter_interrupt(best, intrpt);
+}
+
+
+void Emulator::enter_interrupt(int cause, int &intrpt) {
+  intrpt++;
+  int_count++;
+  int_by_cause[cause]++;
+  // push status;
+  push_reg(_status, true);
+  // push pc;
+  push_reg(_pc);
+  // cause = cause;
+  set_reg(_cause, cause, true);
+  if(cause == _cause_software) {
+    // status = status &(~0x1);
+    control_regs.at(_status) &= ~0x1;
+  } else if(vectored) {
+    // raise current priority level, lower priority sources stay pending
+    control_regs.at(_status) = (control_regs.at(_status) & ~_status_cpl_mask) | (irq_prio[cause] << _status_cpl_shift);
+  } else {
+    // status = status | I;
+    control_regs.at(_status) |= _status_i;
+  }
+  // pc = handle or pc = mem32[handle + cause * 4];
+  set_reg(_pc, interrupt_target(cause));
+}
+
+
+uint32_t Emulator::interrupt_target(int cause) {
+  if(!vectored)
+    return control_regs.at(_handle);
+  uint32_t entry = control_regs.at(_handle) + cause * WORD_SIZE;
+  if(!is_written(entry))
+    throw CustomException("*EE : No vector table entry for interrupt cause");
+  return load_val_from_mem(entry);
+}
+// *****************************************************************************************************
+
+// *****************************************************************************************************
+// Memory functions
+s_PageEntry *Emulator::find_page_entry(uint32_t addr) {
+  s_PageTable *table = page_dir[addr >> _dir_shift].get();
+  if(table == nullptr)
+    return nullptr;
+  return &table->entries[(addr >> _page_shift) & _table_mask];
+}
+
+
+s_PageEntry &Emulator::get_page_entry(uint32_t addr) {
+  if(!page_dir[addr >> _dir_shift])
+    page_dir[addr >> _dir_shift].reset(new s_PageTable());
+  return page_dir[addr >> _dir_shift]->entries[(addr >> _page_shift) & _table_mask];
+}
+
+
+bool Emulator::is_written(uint32_t addr) {
+  s_PageEntry *entry = find_page_entry(addr);
+  return entry != nullptr && entry->page != nullptr && (entry->page->written[(addr & _page_mask) >> 7] >> ((addr >> 2) & 31) & 1);
+}
+
+
+uint8_t Emulator::read_byte(uint32_t addr) {
+  s_PageEntry *entry = find_page_entry(addr);
+  if(entry == nullptr || entry->page == nullptr)
+    return 0;
+  return entry->page->data[addr & _page_mask];
+}
+
+
+void Emulator::write_byte(uint32_t addr, uint8_t val) {
+  s_Page *page = writable_page(addr);
+  page->data[addr & _page_mask] = val;
+  mark_written(page, addr);
+}
+
+
+s_Page *Emulator::writable_page(uint32_t addr) {
+  // allocates missing page, or makes private copy of shared image page
+  s_PageEntry &entry = get_page_entry(addr);
+  if(entry.page == nullptr || (entry.flags & _page_shared)) {
+    s_Page *page;
+    if(!free_pages.empty()) {
+      page = free_pages.back();
+      free_pages.pop_back();
+    } else {
+      pages.push_back(unique_ptr<s_Page>(new s_Page()));
+      page = pages.back().get();
+    }
+    *page = (entry.page != nullptr) ? *entry.page : s_Page();
+    entry.page = page;
+    entry.code = nullptr;
+    entry.flags &= ~_page_shared;
+  }
+  return entry.page;
+}
+
+
+// Raw access, without watchpoints and tracing, used by loader and emulator itself
+uint32_t Emulator::read_memory(uint32_t addr) {
+  uint32_t temp = 0;
+  __SET_BITS_0_7(temp, read_byte(addr));
+  __SET_BITS_8_15(temp, read_byte(addr + 1));
+  __SET_BITS_16_23(temp, read_byte(addr + 2));
+  __SET_BITS_24_31(temp, read_byte(addr + 3));
+  return temp;
+}
+
+
+void Emulator::set_memory(uint32_t addr, uint32_t val) {
+  write_byte(addr, __GET_BITS_0_7(val));
+  write_byte(addr + 1, __GET_BITS_8_15(val));
+  write_byte(addr + 2, __GET_BITS_16_23(val));
+  write_byte(addr + 3, __GET_BITS_24_31(val));
+}
+
+
+// Guest loads and stores. Only page lookup and flag check are done on every access,
+// accesses to flagged pages, unmapped pages and words crossing pages go to slow path.
+uint32_t Emulator::load_val_from_mem(uint32_t addr) {
+  s_PageEntry *entry = find_page_entry(addr);
+  if(entry != nullptr && entry->page != nullptr && ((entry->flags | mem_flags) & _page_slow_read) == 0 
+    && (addr & _page_mask) <= _page_size - WORD_SIZE) {
+    uint8_t *data = &entry->page->data[addr & _page_mask];
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+  }
+  return load_slow(addr);
+}
+
+
+void Emulator::set_mem(uint32_t addr, uint32_t val) {
+  s_PageEntry *entry = find_page_entry(addr);
+  if(entry != nullptr && entry->page != nullptr && ((entry->flags | mem_flags) & _page_slow_write) == 0 
+    && (addr & _page_mask) <= _page_size - WORD_SIZE) {
+    uint8_t *data = &entry->page->data[addr & _page_mask];
+    data[0] = __GET_BITS_0_7(val);
+    data[1] = __GET_BITS_8_15(val);
+    data[2] = __GET_BITS_16_23(val);
+    data[3] = __GET_BITS_24_31(val);
+    mark_written(entry->page, addr);
+    mark_written(entry->page, addr + WORD_SIZE - 1);
+    return;
+  }
+  set_mem_slow(addr, val);
+}
+
+
+uint32_t Emulator::load_slow(uint32_t addr) {
+  uint16_t flags = page_flags(addr, WORD_SIZE) | mem_flags;
+  uint32_t val = ((flags & _page_mmio) && is_device_reg(addr)) ? mmio_read(addr) : read_memory(addr);
+  if(flags & _page_trace)
+    record_access(addr, _acc_read);
+  if(flags & _page_plugin)
+    plugin_accesses.push_back(s_MemAccess(cur_inst_pc, addr, _acc_read, val));
+  if(flags & _page_watch_read)
+    check_watchpoints(addr, val, val, _watch_read);
+  return val;
+}
+
+
+void Emulator::set_mem_slow(uint32_t addr, uint32_t val) {
+  uint16_t flags = page_flags(addr, WORD_SIZE) | mem_flags;
+  if((flags & _page_mmio) && is_device_reg(addr)) {
+    mmio_write(addr, val);
+    if(flags & _page_plugin)
+      plugin_accesses.push_back(s_MemAccess(cur_inst_pc, addr, _acc_write, val));
+    return;
+  }
+  uint32_t old_val = (flags & _page_watch_write) ? read_memory(addr) : 0;
+  if(!checkpoints.empty()) {
+    save_page(addr);
+    if(((addr + WORD_SIZE - 1) & ~_page_mask) != (addr & ~_page_mask))
+      save_page(addr + WORD_SIZE - 1);
+  }
+  if((flags & _page_track) && addr < static_cast<uint64_t>(track_addr) + WORD_SIZE && static_cast<uint64_t>(addr) + WORD_SIZE > track_addr) {
+    track_hit = inst_count;
+    track_found = true;
+  }
+  if(track_dirty) {
+    mark_dirty(addr);
+    if(((addr + WORD_SIZE - 1) & ~_page_mask) != (addr & ~_page_mask))
+      mark_dirty(addr + WORD_SIZE - 1);
+  }
+  set_memory(addr, val);
+  if(flags & _page_trace)
+    record_access(addr, _acc_write);
+  if(flags & _page_plugin)
+    plugin_accesses.push_back(s_MemAccess(cur_inst_pc, addr, _acc_write, val));
+  if(flags & _page_watch_write)
+    check_watchpoints(addr, val, old_val, _watch_write);
+}
+
+
+void Emulator::start_dirty_tracking() {
+  // every mapped page gets flagged, unmapped pages go through slow path anyway
+  track_dirty = true;
+  for(auto& table : page_dir)
+    if(table)
+      for(int i = 0; i < _table_size; i++)
+        if(table->entries[i].page != nullptr)
+          table->entries[i].flags |= _page_verify;
+}
+
+
+void Emulator::mark_dirty(uint32_t addr) {
+  s_PageEntry *entry = find_page_entry(addr);
+  if(entry != nullptr && entry->page != nullptr && (entry->flags & _page_verify) == 0)
+    return;
+  dirty_pages.push_back(addr & ~_page_mask);
+  if(entry != nullptr)
+    entry->flags &= ~_page_verify;
+}
+
+
+uint16_t Emulator::page_flags(uint32_t addr, int size) {
+  s_PageEntry *first = find_page_entry(addr);
+  s_PageEntry *last = find_page_entry(addr + size - 1);
+  return ((first != nullptr) ? first->flags : 0) | ((last != nullptr) ? last->flags : 0);
+}
+
+
+uint32_t Emulator::resolve_address(string str) {
+  if(is_number(str) && str[0] != '-') {
+    unsigned long addr = (str.substr(0, 2) == "0x") ? stoul(str, nullptr, 16) : stoul(str);
+    if(addr > UINT32_MAX)
+      throw CustomException("*EE : Address out of range");
+    return static_cast<uint32_t>(addr);
+  }
+  auto it = sym_addrs.find(str);
+  if(it == sym_addrs.end())
+    throw CustomException("*EE : Unknown symbol");
+  return it->second;
+}
+
+
+void Emulator::apply_patch(string patch) {
+  // <address|symbol>=<value> writes a word, <address|symbol>=@<file> writes content of the file
+  if(patch.find("=") == string::npos)
+    throw CustomException("*EE : Patch must be given as <address|symbol>=<value> or <address|symbol>=@<file>");
+  uint32_t addr = resolve_address(patch.substr(0, patch.find("=")));
+  string value = patch.substr(patch.find("=") + 1);
+  if(!value.empty() && value[0] == '@') {
+    ifstream patchFile(value.substr(1), ios::in | ios::binary);
+    if(!patchFile.is_open())
+      throw CustomException("*EE : Patch file not open");
+    string content((istreambuf_iterator<char>(patchFile)), istreambuf_iterator<char>());
+    if(static_cast<uint64_t>(addr) + content.size() > (1ull << 32))
+      throw CustomException("*EE : Patch file does not fit in memory");
+    dma_to_memory(addr, reinterpret_cast<const uint8_t *>(content.data()), content.size());
+  } else {
+    if(!is_number(value))
+      throw CustomException("*EE : Patch value must be a number");
+    set_memory(addr, static_cast<uint32_t>(string_to_val(value)));
+  }
+}
+
+
+void Emulator::add_watchpoint(string option) {
+  // <address or symbol>[,<length>][,r|w|rw][,log|stop]
+  vector<string> fields = divide_line(option, COMMA_CHAR);
+  if(fields.empty() || fields.size() > 4)
+    throw CustomException("*EE : Watchpoint must be given as <address>[,<length>][,r|w|rw][,log|stop]");
+  s_Watchpoint wp;
+  wp.start = resolve_address(fields[0]);
+  uint32_t len = WORD_SIZE;
+  for(int i = 1; i < fields.size(); i++) {
+    if(fields[i] == "r")
+      wp.kind = _watch_read;
+    else if(fields[i] == "w")
+      wp.kind = _watch_write;
+    else if(fields[i] == "rw")
+      wp.kind = _watch_read | _watch_write;
+    else if(fields[i] == "log")
+      wp.stop = false;
+    else if(fields[i] == "stop")
+      wp.stop = true;
+    else if(is_number(fields[i]) && string_to_val(fields[i]) > 0)
+      len = string_to_val(fields[i]);
+    else 
+      throw CustomException("*EE : Bad watchpoint field");
+  }
+  wp.end = static_cast<uint64_t>(wp.start) + len;
+  watchpoints.push_back(wp);
+  uint16_t flags = ((wp.kind & _watch_read) ? _page_watch_read : 0) | ((wp.kind & _watch_write) ? _page_watch_write : 0);
+  for(uint64_t page = wp.start & ~_page_mask; page < wp.end; page += _page_size)
+    get_page_entry(static_cast<uint32_t>(page)).flags |= flags;
+}
+
+
+void Emulator::check_watchpoints(uint32_t addr, uint32_t val, uint32_t old_val, int kind) {
+  // replay after reverse step already reported these
+  if(replaying)
+    return;
+  for(int i = 0; i < watchpoints.size(); i++) {
+    s_Watchpoint &wp = watchpoints[i];
+    if((wp.kind & kind) == 0 || addr >= wp.end || static_cast<uint64_t>(addr) + WORD_SIZE <= wp.start)
+      continue;
+    cout << "*W : " << ((kind == _watch_write) ? "write" : "read") << " mem[0x" << hex << setw(8) << setfill('0') << addr << "]";
+    if(kind == _watch_write)
+      cout << " = 0x" << setw(8) << setfill('0') << val << " (was 0x" << setw(8) << setfill('0') << old_val << ")";
+    else 
+      cout << " -> 0x" << setw(8) << setfill('0') << val;
+    cout << " by pc = " << symbolize(symbols, cur_inst_pc) << endl;
+    if(wp.stop && !stopped) {
+      stopped = true;
+      cout << "------------------------------------------------------------------" << endl;
+      cout << "Emulation stopped on watchpoint" << endl;
+    }
+  }
+}
+// *****************************************************************************************************
+
+// *****************************************************************************************************
+// Reverse execution
+// Checkpoint holds registers and, filled lazily, old content of every page written after it.
+// Going back means undoing pages down to nearest earlier checkpoint and replaying forward.
+void Emulator::take_checkpoint() {
+  checkpoints.push_back(s_Checkpoint(inst_count));
+  s_Checkpoint &cp = checkpoints.back();
+  for(auto& elem : regs)
+    cp.regs[elem.first] = elem.second;
+  for(auto& elem : control_regs)
+    cp.control_regs[elem.first] = elem.second;
+  cp.pending_irqs = pending_irqs;
+  cp.intrpt = intrpt;
+  cp.int_count = int_count;
+  for(int i = 0; i < _dir_size; i++)
+    if(page_dir[i])
+      for(int j = 0; j < _table_size; j++)
+        if(page_dir[i]->entries[j].page != nullptr)
+          page_dir[i]->entries[j].flags |= _page_snapshot;
+  next_checkpoint = inst_count + checkpoint_interval;
+}
+
+
+void Emulator::save_page(uint32_t addr) {
+  s_PageEntry *entry = find_page_entry(addr);
+  if(entry != nullptr && entry->page != nullptr && (entry->flags & _page_snapshot) == 0)
+    return;
+  s_Checkpoint &cp = checkpoints.back();
+  if(entry == nullptr || entry->page == nullptr)
+    cp.undo.push_back(make_pair(addr & ~_page_mask, unique_ptr<s_Page>()));
+  else {
+    cp.undo.push_back(make_pair(addr & ~_page_mask, unique_ptr<s_Page>(new s_Page(*entry->page))));
+    entry->flags &= ~_page_snapshot;
+    checkpoint_bytes += sizeof(s_Page);
+  }
+  // oldest checkpoints are dropped when over budget, latest one is always kept
+  while(checkpoint_bytes > checkpoint_budget && checkpoints.size() > 1) {
+    for(auto& elem : checkpoints.front().undo)
+      if(elem.second)
+        checkpoint_bytes -= sizeof(s_Page);
+    checkpoints.pop_front();
+  }
+}
+
+
+void Emulator::restore_checkpoint(int index) {
+  for(int i = checkpoints.size() - 1; i >= index; i--) {
+    for(auto& elem : checkpoints[i].undo) {
+      s_PageEntry &entry = get_page_entry(elem.first);
+      if(!elem.second) {
+        if(entry.page != nullptr && (entry.flags & _page_shared) == 0)
+          free_pages.push_back(entry.page);
+        entry.page = nullptr;
+        entry.code = nullptr;
+        entry.flags &= ~_page_shared;
+      } else {
+        *writable_page(elem.first) = *elem.second;
+        checkpoint_bytes -= sizeof(s_Page);
+      }
+    }
+    checkpoints[i].undo.clear();
+  }
+  checkpoints.resize(index + 1);
+  s_Checkpoint &cp = checkpoints.back();
+  // assigned element by element, pc and sp point into regs
+  for(auto& elem : cp.regs)
+    regs[elem.first] = elem.second;
+  for(auto& elem : cp.control_regs)
+    control_regs[elem.first] = elem.second;
+  pending_irqs = cp.pending_irqs;
+  intrpt = cp.intrpt;
+  int_count = cp.int_count;
+  inst_count = cp.inst_count;
+  halted = false;
+  stopped = false;
+  exited = false;
+  for(int i = 0; i < _dir_size; i++)
+    if(page_dir[i])
+      for(int j = 0; j < _table_size; j++)
+        if(page_dir[i]->entries[j].page != nullptr)
+          page_dir[i]->entries[j].flags |= _page_snapshot;
+  next_checkpoint = inst_count + checkpoint_interval;
+}
+
+
+void Emulator::replay_to(uint64_t target) {
+  int index = checkpoints.size() - 1;
+  while(index >= 0 && checkpoints[index].inst_count > target)
+    index--;
+  if(index < 0)
+    throw CustomException("*EE : Target instruction is before oldest checkpoint");
+  restore_checkpoint(index);
+  // no timing, cache or watchpoint reports while replaying, execution is deterministic
+  s_NoTiming timing;
+  replaying = true;
+  while(inst_count < target)
+    step(timing);
+  replaying = false;
+}
+
+
+void Emulator::reverse_to_write(uint32_t addr) {
+  uint64_t origin = inst_count;
+  uint64_t end = inst_count;
+  track_addr = addr;
+  track_found = false;
+  mem_flags |= _page_track;
+  // search segments between checkpoints backwards, last write in a segment wins
+  while(!track_found) {
+    int index = checkpoints.size() - 1;
+    while(index >= 0 && checkpoints[index].inst_count >= end)
+      index--;
+    if(index < 0)
+      break;
+    uint64_t start = checkpoints[index].inst_count;
+    replay_to(start);
+    s_NoTiming timing;
+    replaying = true;
+    while(inst_count < end)
+      step(timing);
+    replaying = false;
+    end = start;
+  }
+  mem_flags &= ~_page_track;
+  if(!track_found) {
+    cout << "No write to 0x" << hex << setw(8) << setfill('0') << addr << " since oldest checkpoint" << endl;
+    replay_to(origin);
+    return;
+  }
+  replay_to(track_hit);
+  cout << "Last write to 0x" << hex << setw(8) << setfill('0') << addr << " by pc = " << symbolize(symbols, *pc) << endl;
+}
+
+
+template<typename Timing>
+void Emulator::forward(Timing &timing, uint64_t count) {
+  if(halted) {
+    cout << "Program is not running, step back first" << endl;
+    return;
+  }
+  stopped = false;
+  try {
+    for(uint64_t i = 0; i < count && !halted && !stopped; i++) {
+      step(timing);
+      halted = oc == '0' || exited;
+    }
+  } catch(const CustomException &e) {
+    // faulting instruction did not retire, it is still reachable by stepping back
+    cout << e.what() << endl;
+    halted = true;
+  }
+}
+
+
+template<typename Timing>
+void Emulator::debug_loop(Timing &timing) {
+  // s [n] - step, c - continue, rs [n] - reverse step, rc <addr|symbol> - reverse continue to last write,
+  // p - print state, q - quit
+  string line;
+  cout << "(emu) " << flush;
+  while(getline(cin, line)) {
+    vector<string> tokens;
+    for(auto& token : divide_line(line, SPACE_CHAR))
+      if(!token.empty())
+        tokens.push_back(token);
+    string cmd = tokens.empty() ? "" : tokens[0];
+    try {
+      if(cmd == "s")
+        forward(timing, (tokens.size() > 1) ? string_to_val(tokens[1]) : 1);
+      else if(cmd == "c")
+        forward(timing, UINT64_MAX);
+      else if(cmd == "rs") {
+        uint64_t count = (tokens.size() > 1) ? string_to_val(tokens[1]) : 1;
+        replay_to((count < inst_count) ? inst_count - count : 0);
+      } else if(cmd == "rc" && tokens.size() > 1)
+        reverse_to_write(resolve_address(tokens[1]));
+      else if(cmd == "q")
+        return;
+      else if(cmd != "p") {
+        cout << "Commands : s [n], c, rs [n], rc <address|symbol>, p, q" << endl;
+        cout << "(emu) " << flush;
+        continue;
+      }
+      cout << "pc = " << symbolize(symbols, *pc) << ", " << dec << inst_count << " instructions executed" << endl;
+      if(cmd == "p")
+        print_state();
+    } catch(const CustomException &e) {
+      replaying = false;
+      cout << e.what() << endl;
+    }
+    cout << "(emu) " << flush;
+  }
+}
+// *****************************************************************************************************
+
 // *****************************************************************************************************
 // Passage instructions
 void Emulator::decode_pc_instruction(){
-  if(memory.count(*pc) <= 0)
+  s_PageEntry *entry = find_page_entry(*pc);
+  // word never written by image or guest holds no instruction, zero there would decode as halt
+  if(entry == nullptr || entry->page == nullptr || !is_written(*pc) || !is_written(*pc + WORD_SIZE - 1))
     throw CustomException("*EE : There is no instruction at current pc");
-  // mem is ass follows : addr : 7_0 15_8 23_16 31_24 : little endian
-  // addr : str0[0][1] str1[0][1] str2[0][1] str3[0][1]
+  // word (addr[11:7]) and bit (addr[6:2]) of instruction in page bitmap
+  if(entry->cov != nullptr)
+    entry->cov[(*pc & _page_mask) >> 7] |= 1u << ((*pc >> 2) & 31);
+  cur_inst_pc = *pc;
+  if(icache)
+    record_access(*pc, _acc_fetch);
+  if(entry->code != nullptr && (*pc & (WORD_SIZE - 1)) == 0) {
+    // unmodified image page, fields below used only for debugging are not filled
+    const s_DecodedInst &inst = entry->code[(*pc & _page_mask) / WORD_SIZE];
+    oc = inst.oc;
+    mod = inst.mod;
+    regA = inst.regA;
+    regB = inst.regB;
+    regC = inst.regC;
+    disp = inst.disp;
+    *pc += WORD_SIZE;
+    return;
+  }
+  // mem is as follows : addr : 7_0 15_8 23_16 31_24 : little endian
   // Instruction is op - mod - rega - regb - regc - disp - disp - disp => all 4b
-  oc = memory.at(*pc)[3][0];
-  mod = memory.at(*pc)[3][1];
-  regA_ch = memory.at(*pc)[2][0];
-  regB_ch = memory.at(*pc)[2][1];
-  regC_ch = memory.at(*pc)[1][0];
-  dh = memory.at(*pc)[1][1];
-  dm = memory.at(*pc)[0][0];
-  dl = memory.at(*pc)[0][1];
-
-  regA = char_to_val(regA_ch);
-  regB = char_to_val(regB_ch);
-  regC = char_to_val(regC_ch);
+  static const char hex_digits[] = "0123456789abcdef";
+  uint32_t inst = read_memory(*pc);
+  oc = hex_digits[__GET_BITS_28_31(inst)];
+  mod = hex_digits[__GET_BITS_24_27(inst)];
+  regA_ch = hex_digits[__GET_BITS_20_23(inst)];
+  regB_ch = hex_digits[__GET_BITS_16_19(inst)];
+  regC_ch = hex_digits[__GET_BITS_12_15(inst)];
+  dh = hex_digits[__GET_BITS_8_11(inst)];
+  dm = hex_digits[__GET_BITS_4_7(inst)];
+  dl = hex_digits[__GET_BITS_0_3(inst)];
 
-  stringstream ss;
-  ss << dh << dm << dl;  
-  unsigned int hexValue = std::stoi(ss.str(), nullptr, 16);
+  regA = __GET_BITS_20_23(inst);
+  regB = __GET_BITS_16_19(inst);
+  regC = __GET_BITS_12_15(inst);
+
+  unsigned int hexValue = inst & 0xfff;
   // Check the most significant bit to determine the sign
   bool isNegative = (hexValue & 0x800) != 0;
   // Convert to a signed integer
@@ -477,58 +1220,216 @@ void Emulator::decode_pc_instruction(){
 
 // *****************************************************************************************************
 // Helper instructions
-string Emulator::uint32_t_to_string(uint32_t val) {
+void Emulator::parse_options() {
+  for(int i = 0; i < options.size(); i++) {
+    if(options[i] == "-vectored")
+      vectored = true;
+    else if(options[i].find("-irq_prio=") == 0) {
+      // -irq_prio=<cause>:<priority>
+      string arg = options[i].substr(options[i].find("=") + 1);
+      if(arg.find(":") == string::npos)
+        throw CustomException("*EE : Interrupt priority must be given as cause:priority");
+      int cause = string_to_val(arg.substr(0, arg.find(":")));
+      int prio = string_to_val(arg.substr(arg.find(":") + 1));
+      if(cause <= 0 || cause >= _num_causes)
+        throw CustomException("*EE : Interrupt cause out of bounds");
+      if(prio < 0 || prio > _max_irq_prio)
+        throw CustomException("*EE : Interrupt priority out of bounds");
+      irq_prio[cause] = prio;
+    } else if(options[i] == "-timing")
+      timing_on = true;
+    else if(options[i].find("-timing=") == 0) {
+      timing_on = true;
+      timing_file = options[i].substr(options[i].find("=") + 1);
+    } else if(options[i].find("-watch=") == 0)
+      watch_options.push_back(options[i].substr(options[i].find("=") + 1));
+    else if(options[i] == "-debug") {
+      debug_on = true;
+      if(checkpoint_interval == 0)
+        checkpoint_interval = _default_checkpoint_interval;
+    } else if(options[i].find("-checkpoint=") == 0) {
+      // -checkpoint=<interval>[:<budget in MB>]
+      string arg = options[i].substr(options[i].find("=") + 1);
+      int interval = string_to_val(arg.substr(0, arg.find(":")));
+      if(interval <= 0)
+        throw CustomException("*EE : Checkpoint interval must be positive");
+      checkpoint_interval = interval;
+      if(arg.find(":") != string::npos) {
+        int budget = string_to_val(arg.substr(arg.find(":") + 1));
+        if(budget <= 0)
+          throw CustomException("*EE : Checkpoint memory budget must be positive");
+        checkpoint_budget = static_cast<uint64_t>(budget) << 20;
+      }
+    } else if(options[i] == "-coverage")
+      coverage_on = true;
+    else if(options[i].find("-coverage=") == 0) {
+      coverage_on = true;
+      coverage_file = options[i].substr(options[i].find("=") + 1);
+    } else if(options[i].find("-lanes=") == 0)
+      lanes_file = options[i].substr(options[i].find("=") + 1);
+    else if(options[i].find("-block=") == 0)
+      block.reset(new BlockDevice(options[i].substr(options[i].find("=") + 1)));
+    else if(options[i].find("-set=") == 0)
+      patches.push_back(options[i].substr(options[i].find("=") + 1));
+    else if(options[i].find("-stats=") == 0)
+      stats_file = options[i].substr(options[i].find("=") + 1);
+    else if(options[i].find("-stats_interval=") == 0) {
+      stats_interval = string_to_val(options[i].substr(options[i].find("=") + 1));
+      if(stats_interval <= 0)
+        throw CustomException("*EE : Statistics interval must be positive");
+    } else if(options[i] == "-semihost")
+      semihost_on = true;
+    else if(options[i].find("-plugin=") == 0)
+      plugin_spec = options[i].substr(options[i].find("=") + 1);
+    else if(options[i] == "-profile")
+      profile_on = true;
+    else if(options[i].find("-profile=") == 0) {
+      profile_on = true;
+      profile_file = options[i].substr(options[i].find("=") + 1);
+    }
+    else if(options[i] == "-verify")
+      verify_on = true;
+    else if(options[i].find("-verify=") == 0) {
+      int interval = string_to_val(options[i].substr(options[i].find("=") + 1));
+      if(interval <= 0)
+        throw CustomException("*EE : Verify interval must be positive");
+      verify_on = true;
+      verify_interval = interval;
+    }
+    else if(options[i].find("-icache=") == 0)
+      icache.reset(new CacheSim("I-cache", options[i].substr(options[i].find("=") + 1)));
+    else if(options[i].find("-dcache=") == 0)
+      dcache.reset(new CacheSim("D-cache", options[i].substr(options[i].find("=") + 1)));
+    else if(options[i].find("-sym=") == 0)
+      sym_file = options[i].substr(options[i].find("=") + 1);
+    else 
+      throw CustomException("*EE : Unknown emulator option");
+  }
+}
+
+
+void Emulator::load_symbols() {
+  // linker writes symbol map next to the hex file, program.hex -> program.sym
+  string fileName = sym_file;
+  if(fileName.empty() && inFileName.length() > 4 && inFileName.substr(inFileName.length() - 4) == ".hex")
+    fileName = inFileName.substr(0, inFileName.length() - 4) + ".sym";
+  ifstream symFile(fileName, ios::in);
+  if(!symFile.is_open()) {
+    if(!sym_file.empty())
+      throw CustomException("*EE : Symbol map file not open");
+    return;
+  }
+  string line;
+  while(getline(symFile, line)) {
+    vector<string> tokens = divide_line(line, SPACE_CHAR);
+    if(tokens.size() != 2)
+      throw CustomException("*EE : Bad line in symbol map file");
+    if(tokens[0].empty() || tokens[0].length() > 8 || !is_number("0x" + tokens[0]))
+      throw CustomException("*EE : Bad line in symbol map file");
+    uint32_t addr = static_cast<uint32_t>(stoul(tokens[0], nullptr, 16));
+    symbols[addr] = tokens[1];
+    sym_addrs[tokens[1]] = addr;
+  }
+}
+
+
+string Emulator::symbolize(const map<uint32_t, string> &symbols, uint32_t addr) {
   stringstream ss;
-  uint32_t lowestBits = __GET_BITS_0_7(val);
-  ss << hex << setw(2) << setfill('0') << lowestBits;
+  ss << "0x" << hex << setw(8) << setfill('0') << addr;
+  auto it = symbols.upper_bound(addr);
+  // symbols have no size, so far away addresses (stack, mmio) are left as they are
+  if(it != symbols.begin() && addr - prev(it)->first < _max_sym_offset) {
+    it--;
+    ss << " <" << it->second;
+    if(addr != it->first)
+      ss << "+0x" << hex << (addr - it->first);
+    ss << ">";
+  }
   return ss.str();
 }
 
 
-void Emulator::set_memory(uint32_t addr, uint32_t val) {
-  string str = uint32_t_to_string(__GET_BITS_0_7(val));
-  // memory.at(addr)[0] = "" + __GET_BITS_0_7(val);
-  memory.at(addr)[0] = uint32_t_to_string(__GET_BITS_0_7(val));
-  memory.at(addr)[1] = uint32_t_to_string(__GET_BITS_8_15(val));
-  memory.at(addr)[2] = uint32_t_to_string(__GET_BITS_16_23(val));
-  memory.at(addr)[3] = uint32_t_to_string(__GET_BITS_24_31(val));
+void Emulator::record_access(uint32_t addr, uint8_t kind) {
+  if(replaying)
+    return;
+  access_batch.push_back(s_MemAccess(cur_inst_pc, addr, kind));
+  if(access_batch.size() >= _cache_batch_size)
+    flush_access_batch();
 }
 
 
-int Emulator::char_to_val(char ch){
-  stringstream ss;
-  ss << "0x" << ch;
-  return string_to_val(ss.str());
+void Emulator::flush_access_batch() {
+  if(icache)
+    icache->access_batch(access_batch, true);
+  if(dcache)
+    dcache->access_batch(access_batch, false);
+  access_batch.clear();
 }
 
 
-uint32_t Emulator::load_val_from_mem(uint32_t addr) {
-  uint32_t temp = 0;
-  __SET_BITS_0_7(temp, string_to_val("0x" + memory.at(addr)[0]));
-  __SET_BITS_8_15(temp, string_to_val("0x" + memory.at(addr)[1]));
-  __SET_BITS_16_23(temp, string_to_val("0x" + memory.at(addr)[2]));
-  __SET_BITS_24_31(temp, string_to_val("0x" + memory.at(addr)[3]));
-  return temp;
+void Emulator::load_line_table() {
+  // linker writes line table next to the hex file, program.hex -> program.lines
+  string base = inFileName;
+  if(base.length() > 4 && base.substr(base.length() - 4) == ".hex")
+    base = base.substr(0, base.length() - 4);
+  if(coverage_file.empty())
+    coverage_file = base + ".info";
+  ifstream linesFile(base + ".lines", ios::in);
+  if(!linesFile.is_open())
+    throw CustomException("*EE : Line table not found, assemble with -g");
+  string line;
+  while(getline(linesFile, line)) {
+    stringstream ss(line);
+    uint32_t addr;
+    int lineNo;
+    string file;
+    if(!(ss >> hex >> addr >> dec >> lineNo))
+      continue;
+    getline(ss >> ws, file);
+    src_lines.push_back(s_SrcLine(addr, lineNo, file));
+    s_PageEntry &entry = get_page_entry(addr);
+    if(entry.cov == nullptr) {
+      cov_bitmaps.push_back(unique_ptr<uint32_t[]>(new uint32_t[_cov_words]()));
+      entry.cov = cov_bitmaps.back().get();
+    }
+  }
+}
+
+
+void Emulator::write_coverage() {
+  // lcov tracefile, line is hit if its first instruction was executed
+  map<string, map<int, int>> files;
+  for(auto& elem : src_lines) {
+    s_PageEntry *entry = find_page_entry(elem.addr);
+    int hit = (entry->cov[(elem.addr & _page_mask) >> 7] >> ((elem.addr >> 2) & 31)) & 1;
+    files[elem.file][elem.line] |= hit;
+  }
+  ofstream out(coverage_file, ios::out | ios::trunc);
+  if(!out.is_open())
+    throw CustomException("*EE : Coverage file not open");
+  out << "TN:" << endl;
+  for(auto& file : files) {
+    int hit = 0;
+    out << "SF:" << file.first << endl;
+    for(auto& elem : file.second) {
+      out << "DA:" << dec << elem.first << "," << elem.second << endl;
+      hit += elem.second;
+    }
+    out << "LF:" << file.second.size() << endl;
+    out << "LH:" << hit << endl;
+    out << "end_of_record" << endl;
+  }
 }
 
+
 void Emulator::fill_memory() {
-  string line;
-  while(getline(inputFile, line)) {
-    string address_str = "0x" + remove_space_back_front(line.substr(0, line.find(":")));
-    uint32_t addr = string_to_val(address_str);
-    if(memory.count(addr) <= 0) {
-      memory.insert(make_pair(addr, vector<string>()));
-      memory.insert(make_pair(addr + WORD_SIZE, vector<string>()));
-    }
-    vector<string> instructions = divide_line(line.substr(line.find_first_not_of(SPACE_CHAR, line.find_first_of(":") + 1)), SPACE_CHAR);
-    auto middleIterator = (instructions.size() == 8) ? (instructions.begin() + instructions.size() / 2) :
-                          (instructions.size() == 4) ? instructions.begin() + instructions.size() : instructions.begin();
-    if(middleIterator == instructions.begin())
-      throw CustomException("*EE : Bad instruction size");
-    // Insert the first half into the first empty vector
-    memory.at(addr).insert(memory.at(addr).end(), instructions.begin(), middleIterator);
-    // Insert the second half into the second empty vector
-    memory.at(addr + WORD_SIZE).insert(memory.at(addr + WORD_SIZE).end(), middleIterator, instructions.end());
+  // image pages are not copied, they point into shared image until written
+  image = SharedImage::get(inFileName, inputFile);
+  for(auto& elem : image->get_pages()) {
+    s_PageEntry &entry = get_page_entry(elem.first);
+    entry.page = &elem.second->page;
+    entry.code = elem.second->code;
+    entry.flags |= _page_shared;
   }
 }
 
@@ -591,20 +1492,1032 @@ string Emulator::remove_space_back_front(string line){
 
 // *****************************************************************************************************
 
+// *****************************************************************************************************
+// Timing model
+CycleTiming::CycleTiming(string costFile, const map<uint32_t, string> &symbols) 
+  : mem_latency(_default_mem_latency), int_entry_cost(_default_int_entry_cycles), int_exit_cost(_default_int_exit_cycles), 
+    cycles(0), instructions(0), cur_lo(1), cur_hi(0), cur_sym(-1) {
+  // cost file lines are "<oc><mod> <cycles>", "mem <cycles>", "int_entry <cycles>" or "int_exit <cycles>"
+  map<int, uint32_t> overrides;
+  if(!costFile.empty()) {
+    ifstream file(costFile, ios::in);
+    if(!file.is_open())
+      throw CustomException("*EE : Timing cost file not open");
+    string line;
+    while(getline(file, line)) {
+      line = line.substr(0, line.find("#"));
+      istringstream iss(line);
+      string key;
+      uint32_t val;
+      if(!(iss >> key))
+        continue;
+      if(!(iss >> val))
+        throw CustomException("*EE : Bad line in timing cost file");
+      if(key == "mem")
+        mem_latency = val;
+      else if(key == "int_entry")
+        int_entry_cost = val;
+      else if(key == "int_exit")
+        int_exit_cost = val;
+      else if(key.length() == 2 && isxdigit(key[0]) && isxdigit(key[1]))
+        overrides[hex_nibble(key[0]) * 16 + hex_nibble(key[1])] = val;
+      else 
+        throw CustomException("*EE : Bad key in timing cost file");
+    }
+  }
+  for(int oc = 0; oc < 16; oc++)
+    for(int mod = 0; mod < 16; mod++)
+      cost[oc][mod] = _default_inst_cycles + mem_accesses(oc, mod) * mem_latency;
+  for(auto& elem : overrides)
+    cost[elem.first / 16][elem.first % 16] = elem.second;
+  for(auto& elem : symbols) {
+    sym_addr.push_back(elem.first);
+    sym_name.push_back(elem.second);
+    sym_cycles.push_back(0);
+  }
+}
+
+
+int CycleTiming::mem_accesses(int oc, int mod) {
+  switch (oc) {
+  case 2:
+    // push pc, and for mod 1 pc = mem32[...]
+    return (mod == 1) ? 2 : 1;
+  case 3:
+    // memory indirect forms of jmp/beq/bne/bgt
+    return (mod >= 8) ? 1 : 0;
+  case 8:
+    // st into mem[mem[...]] reads pointer first
+    return (mod == 2) ? 2 : 1;
+  case 9:
+    return (mod == 2 || mod == 3 || mod == 6 || mod == 7) ? 1 : 0;
+  default:
+    return 0;
+  }
+}
+
+
+void CycleTiming::find_symbol(uint32_t addr) {
+  auto it = upper_bound(sym_addr.begin(), sym_addr.end(), addr);
+  if(it == sym_addr.begin()) {
+    cur_sym = -1;
+    cur_lo = 0;
+    cur_hi = sym_addr.empty() ? 0xffffffff : sym_addr[0];
+    return;
+  }
+  cur_sym = (it - sym_addr.begin()) - 1;
+  cur_lo = sym_addr[cur_sym];
+  cur_hi = (it == sym_addr.end()) ? 0xffffffff : *it;
+}
+
+
+void CycleTiming::interrupt_entry() {
+  cycles += int_entry_cost;
+  if(cur_sym >= 0)
+    sym_cycles[cur_sym] += int_entry_cost;
+}
+
+
+void CycleTiming::interrupt_exit() {
+  cycles += int_exit_cost;
+  if(cur_sym >= 0)
+    sym_cycles[cur_sym] += int_exit_cost;
+}
+
+
+void CycleTiming::report(ostream &out) {
+  out << "------------------------------------------------------------------" << endl;
+  out << "Timing model" << endl;
+  out << "Instructions : " << dec << instructions << endl;
+  out << "Cycles : " << dec << cycles << endl;
+  if(sym_name.empty())
+    return;
+  vector<pair<uint64_t, int>> order;
+  for(int i = 0; i < sym_cycles.size(); i++)
+    if(sym_cycles[i] > 0)
+      order.push_back(make_pair(sym_cycles[i], i));
+  sort(order.rbegin(), order.rend());
+  out << "Cycles per symbol:" << endl;
+  for(auto& elem : order)
+    out << setw(25) << setfill(' ') << left << sym_name[elem.second] << setw(15) << right << dec << elem.first 
+        << setw(9) << fixed << setprecision(2) << (100.0 * elem.first / cycles) << "%" << endl;
+}
+// *****************************************************************************************************
+
+// *****************************************************************************************************
+// Cache simulator
+CacheSim::CacheSim(string name, string config) : name(name), policy(CACHE_LRU), tick(0), rnd(0x2545f491), hits(0), misses(0) {
+  vector<string> fields;
+  string field;
+  istringstream iss(config);
+  while(getline(iss, field, ':'))
+    fields.push_back(field);
+  if(fields.size() < 3 || fields.size() > 4)
+    throw CustomException("*EE : Cache config must be <size>:<assoc>:<line size>[:<policy>]");
+  size = stoul(fields[0], nullptr, 0);
+  assoc = stoul(fields[1], nullptr, 0);
+  line_size = stoul(fields[2], nullptr, 0);
+  if(fields.size() == 4) {
+    policy = -1;
+    for(int i = CACHE_LRU; i <= CACHE_RANDOM; i++)
+      if(fields[3] == e_n_CachePolicy[i])
+        policy = i;
+    if(policy < 0)
+      throw CustomException("*EE : Unknown cache replacement policy");
+  }
+  if(line_size < WORD_SIZE || (line_size & (line_size - 1)) != 0)
+    throw CustomException("*EE : Cache line size must be power of two, at least one word");
+  if(assoc == 0 || size % (assoc * line_size) != 0)
+    throw CustomException("*EE : Cache size must be multiple of assoc * line size");
+  num_sets = size / (assoc * line_size);
+  if((num_sets & (num_sets - 1)) != 0)
+    throw CustomException("*EE : Number of cache sets must be power of two");
+  tags.assign(num_sets * assoc, 0);
+  stamp.assign(num_sets * assoc, 0);
+  valid.assign(num_sets * assoc, false);
+}
+
+
+void CacheSim::access_batch(const vector<s_MemAccess> &batch, bool inst) {
+  for(int i = 0; i < batch.size(); i++) {
+    if((batch[i].kind == _acc_fetch) != inst)
+      continue;
+    uint32_t line_addr = batch[i].addr & ~(line_size - 1);
+    access_line(batch[i].pc, line_addr);
+    // unaligned word that spans two lines touches both of them
+    if((batch[i].addr & (line_size - 1)) + WORD_SIZE > line_size)
+      access_line(batch[i].pc, line_addr + line_size);
+  }
+}
+
+
+void CacheSim::access_line(uint32_t pc, uint32_t line_addr) {
+  tick++;
+  uint32_t set = (line_addr / line_size) & (num_sets - 1);
+  uint32_t tag = line_addr / line_size / num_sets;
+  int base = set * assoc;
+  int victim = base;
+  for(int w = base; w < base + assoc; w++) {
+    if(valid[w] && tags[w] == tag) {
+      hits++;
+      if(policy == CACHE_LRU)
+        stamp[w] = tick;
+      return;
+    }
+    // prefer empty way, otherwise oldest stamp
+    if(!valid[victim])
+      continue;
+    if(!valid[w] || stamp[w] < stamp[victim])
+      victim = w;
+  }
+  misses++;
+  miss_pc[pc]++;
+  miss_addr[line_addr]++;
+  if(policy == CACHE_RANDOM && valid[victim]) {
+    rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+    victim = base + rnd % assoc;
+  }
+  valid[victim] = true;
+  tags[victim] = tag;
+  stamp[victim] = tick;
+}
+
+
+void CacheSim::report(ostream &out, const map<uint32_t, string> &symbols) {
+  uint64_t total = hits + misses;
+  out << name << " : " << dec << size << "B, " << assoc << "-way, " << line_size << "B lines, " << e_n_CachePolicy[policy] << endl;
+  out << "Accesses : " << total << " hits : " << hits << " misses : " << misses;
+  if(total > 0)
+    out << " hit rate : " << fixed << setprecision(2) << (100.0 * hits / total) << "% miss rate : " << (100.0 * misses / total) << "%";
+  out << endl;
+  const unordered_map<uint32_t, uint64_t> *tables[] = {&miss_pc, &miss_addr};
+  const string titles[] = {"Top missing pcs:", "Top missing lines:"};
+  for(int t = 0; t < 2; t++) {
+    vector<pair<uint64_t, uint32_t>> order;
+    for(auto& elem : *tables[t])
+      order.push_back(make_pair(elem.second, elem.first));
+    sort(order.begin(), order.end(), [](const pair<uint64_t, uint32_t> &a, const pair<uint64_t, uint32_t> &b) {
+      return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+    if(order.size() > _cache_report_top)
+      order.resize(_cache_report_top);
+    out << titles[t] << endl;
+    for(auto& elem : order)
+      out << setw(10) << setfill(' ') << right << dec << elem.first << "  " << Emulator::symbolize(symbols, elem.second) << endl;
+  }
+}
+// *****************************************************************************************************
+
+// *****************************************************************************************************
+// Statistics
+volatile sig_atomic_t Emulator::stats_pending = 0;
+
+static void request_stats(int) {
+  Emulator::stats_pending = 1;
+}
+
+
+void Emulator::start_stats() {
+  run_start = last_stats_time = chrono::steady_clock::now();
+  last_stats_count = inst_count;
+  signal(SIGUSR1, request_stats);
+  if(stats_interval > 0) {
+    signal(SIGALRM, request_stats);
+    struct itimerval timer;
+    timer.it_interval.tv_sec = timer.it_value.tv_sec = stats_interval;
+    timer.it_interval.tv_usec = timer.it_value.tv_usec = 0;
+    setitimer(ITIMER_REAL, &timer, nullptr);
+  }
+}
+
+
+void Emulator::dump_stats() {
+  // everything except counters is gathered here, so nothing is added to emulation loop
+  stats_pending = 0;
+  auto now = chrono::steady_clock::now();
+  double total = chrono::duration<double>(now - run_start).count();
+  double since = chrono::duration<double>(now - last_stats_time).count();
+  uint64_t touched = 0;
+  for(auto& table : page_dir)
+    if(table)
+      for(int i = 0; i < _table_size; i++)
+        if(table->entries[i].page != nullptr)
+          touched++;
+  long rss_pages = 0;
+  ifstream statm("/proc/self/statm");
+  statm >> rss_pages >> rss_pages;
+
+  stringstream ss;
+  ss << "------------------------------------------------------------------" << endl;
+  ss << "Statistics after " << fixed << setprecision(1) << total << " s" << endl;
+  ss << "  instructions      " << inst_count << endl;
+  ss << "  inst/s            " << setprecision(0) << ((total > 0) ? inst_count / total : 0)
+    << " (last " << ((since > 0) ? (inst_count - last_stats_count) / since : 0) << ")" << endl;
+  ss << "  interrupts        " << int_count;
+  for(int cause = 1; cause < _num_causes; cause++)
+    if(int_by_cause[cause] != 0)
+      ss << "  cause " << cause << " : " << int_by_cause[cause];
+  ss << endl;
+  ss << "  pages touched     " << touched << " (" << touched * _page_size / 1024 << " KB)" << endl;
+  ss << "  host rss          " << rss_pages * sysconf(_SC_PAGESIZE) / 1024 << " KB" << endl;
+  if(stats_file.empty())
+    cerr << ss.str();
+  else {
+    ofstream out(stats_file, ios::app);
+    out << ss.str();
+  }
+  last_stats_time = now;
+  last_stats_count = inst_count;
+}
+// *****************************************************************************************************
+
+// *****************************************************************************************************
+// Shared image
+mutex SharedImage::registry_mutex;
+unordered_map<uint64_t, vector<weak_ptr<SharedImage>>> SharedImage::registry;
+unordered_map<string, s_ImageFile> SharedImage::files;
+
+shared_ptr<SharedImage> SharedImage::get(const string &fileName, istream &input) {
+  struct stat st;
+  bool stat_ok = stat(fileName.c_str(), &st) == 0;
+  int64_t mtime = stat_ok ? static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec : 0;
+  {
+    lock_guard<mutex> lock(registry_mutex);
+    auto file = files.find(fileName);
+    if(stat_ok && file != files.end() && file->second.size == st.st_size && file->second.mtime == mtime) {
+      shared_ptr<SharedImage> live = file->second.image.lock();
+      if(live)
+        return live;
+    }
+  }
+  stringstream content;
+  content << input.rdbuf();
+  // FNV-1a of whole hex file
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for(unsigned char ch : content.str())
+    hash = (hash ^ ch) * 0x100000001b3ull;
+  lock_guard<mutex> lock(registry_mutex);
+  shared_ptr<SharedImage> img;
+  shared_ptr<SharedImage> fresh;
+  vector<weak_ptr<SharedImage>> &same_hash = registry[hash];
+  for(int i = 0; i < same_hash.size() && !img; i++) {
+    shared_ptr<SharedImage> live = same_hash[i].lock();
+    if(!live)
+      continue;
+    if(!fresh)
+      fresh = make_shared<SharedImage>(content.str());
+    if(live->same_pages(*fresh))
+      img = live;
+  }
+  if(!img) {
+    img = fresh ? fresh : make_shared<SharedImage>(content.str());
+    same_hash.push_back(img);
+    // new image is rare, images no instance uses any more are dropped here
+    for(auto it = registry.begin(); it != registry.end(); ) {
+      vector<weak_ptr<SharedImage>> &images = it->second;
+      images.erase(remove_if(images.begin(), images.end(), [](const weak_ptr<SharedImage> &elem) { return elem.expired(); }), images.end());
+      it = images.empty() ? registry.erase(it) : next(it);
+    }
+    for(auto it = files.begin(); it != files.end(); )
+      it = it->second.image.expired() ? files.erase(it) : next(it);
+  }
+  if(stat_ok)
+    files[fileName] = s_ImageFile(st.st_size, mtime, img);
+  return img;
+}
+
+
+bool SharedImage::same_pages(const SharedImage &other) const {
+  // decoded words follow from page data, so data and written words are enough
+  if(pages.size() != other.pages.size())
+    return false;
+  for(auto it = pages.begin(), jt = other.pages.begin(); it != pages.end(); ++it, ++jt)
+    if(it->first != jt->first || memcmp(&it->second->page, &jt->second->page, sizeof(s_Page)) != 0)
+      return false;
+  return true;
+}
+
+
+SharedImage::SharedImage(const string &content) {
+  istringstream input(content);
+  string line;
+  while(getline(input, line)) {
+    if(line.find(":") == string::npos)
+      continue;
+    uint32_t addr = stoul(line.substr(0, line.find(":")), nullptr, 16);
+    istringstream bytes(line.substr(line.find(":") + 1));
+    string byte;
+    int n = 0;
+    for(; bytes >> byte; n++) {
+      uint32_t at = addr + n;
+      unique_ptr<s_ImagePage> &page = pages[at & ~_page_mask];
+      if(!page)
+        page.reset(new s_ImagePage());
+      page->page.data[at & _page_mask] = static_cast<uint8_t>(stoul(byte, nullptr, 16));
+      Emulator::mark_written(&page->page, at);
+    }
+    if(n != 8 && n != 4)
+      throw CustomException("*EE : Bad instruction size");
+  }
+  for(auto& elem : pages)
+    for(int i = 0; i < _page_words; i++) {
+      uint8_t *data = &elem.second->page.data[i * WORD_SIZE];
+      elem.second->code[i] = decode(static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8)
+        | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24));
+    }
+}
+
+
+s_DecodedInst SharedImage::decode(uint32_t inst) {
+  // same fields as Emulator::decode_pc_instruction
+  static const char hex_digits[] = "0123456789abcdef";
+  s_DecodedInst d;
+  d.oc = hex_digits[__GET_BITS_28_31(inst)];
+  d.mod = hex_digits[__GET_BITS_24_27(inst)];
+  d.regA = __GET_BITS_20_23(inst);
+  d.regB = __GET_BITS_16_19(inst);
+  d.regC = __GET_BITS_12_15(inst);
+  d.disp = (inst & 0x800) ? static_cast<int32_t>((inst & 0xfff) | 0xFFFFF000) : static_cast<int32_t>(inst & 0xfff);
+  return d;
+}
+// *****************************************************************************************************
+
+// *****************************************************************************************************
+// Devices
+void Emulator::map_devices() {
+  // only register page goes through slow path, and only when some device is attached
+  if(block || semihost_on)
+    get_page_entry(_mmio_base).flags |= _page_mmio;
+}
+
+
+bool Emulator::is_device_reg(uint32_t addr) {
+  if(semihost_on && addr == _semi_doorbell)
+    return true;
+  return block && addr >= _blk_cmd && addr <= _blk_size && (addr & (WORD_SIZE - 1)) == 0;
+}
+
+
+uint32_t Emulator::mmio_read(uint32_t addr) {
+  switch (addr){
+  case _blk_status:
+    return block->status;
+  case _blk_sector:
+    return block->sector;
+  case _blk_count:
+    return block->count;
+  case _blk_dma:
+    return block->dma;
+  case _blk_size:
+    return block->sectors();
+  default:
+    return 0;
+  }
+}
+
+
+void Emulator::mmio_write(uint32_t addr, uint32_t val) {
+  switch (addr){
+  case _semi_doorbell:
+    host_call(val);
+    break;
+  case _blk_cmd:
+    block_command(val);
+    break;
+  case _blk_status:
+    block->status &= ~val;
+    break;
+  case _blk_sector:
+    block->sector = val;
+    break;
+  case _blk_count:
+    block->count = val;
+    break;
+  case _blk_dma:
+    block->dma = val;
+    break;
+  default:
+    break;
+  }
+}
+
+
+void Emulator::block_command(uint32_t cmd) {
+  // transfer is done at once, completion interrupt is serviced after current instruction
+  BlockDevice &dev = *block;
+  uint64_t len = static_cast<uint64_t>(dev.count) * _blk_sector_size;
+  bool in_range = dev.count != 0 && static_cast<uint64_t>(dev.sector) + dev.count <= dev.sectors()
+    && static_cast<uint64_t>(dev.dma) + len <= (1ull << 32);
+  if(cmd == _blk_cmd_flush)
+    dev.flush();
+  else if(cmd == _blk_cmd_read && in_range)
+    dma_to_memory(dev.dma, dev.sector_data(dev.sector), len);
+  else if(cmd == _blk_cmd_write && in_range)
+    dma_from_memory(dev.dma, dev.sector_data(dev.sector), len);
+  else 
+    dev.status |= _blk_status_error;
+  dev.status |= _blk_status_done;
+  raise_interrupt(_cause_block);
+}
+
+
+void Emulator::dma_to_memory(uint32_t addr, const uint8_t *src, uint64_t len) {
+  // page by page, pages are allocated the same way as by stores
+  while(len > 0) {
+    uint32_t chunk = min<uint64_t>(len, _page_size - (addr & _page_mask));
+    if(!checkpoints.empty())
+      save_page(addr);
+    s_Page *page = writable_page(addr);
+    memcpy(&page->data[addr & _page_mask], src, chunk);
+    for(uint32_t at = 0; at < chunk; at += WORD_SIZE)
+      mark_written(page, addr + at);
+    mark_written(page, addr + chunk - 1);
+    addr += chunk;
+    src += chunk;
+    len -= chunk;
+  }
+}
+
+
+void Emulator::dma_from_memory(uint32_t addr, uint8_t *dst, uint64_t len) {
+  while(len > 0) {
+    uint32_t chunk = min<uint64_t>(len, _page_size - (addr & _page_mask));
+    s_PageEntry *entry = find_page_entry(addr);
+    if(entry == nullptr || entry->page == nullptr)
+      memset(dst, 0, chunk);
+    else 
+      memcpy(dst, &entry->page->data[addr & _page_mask], chunk);
+    addr += chunk;
+    dst += chunk;
+    len -= chunk;
+  }
+}
+
+
+void Emulator::host_call(uint32_t call) {
+  // serviced by emulator at once, guest handler is not entered
+  uint32_t a1 = regs[_r1], a2 = regs[_r2], a3 = regs[_r3];
+  uint32_t result = 0xFFFFFFFF;
+  switch (call){
+  case _semi_write:
+    result = semi_transfer(a1, a2, a3, true);
+    break;
+  case _semi_read:
+    result = semi_transfer(a1, a2, a3, false);
+    break;
+  case _semi_open:
+    result = semi_open(a1, a2);
+    break;
+  case _semi_close:
+    // stdin, stdout and stderr stay open, handle whose close failed stays usable
+    if(a1 > 2 && semi_files.count(a1) > 0 && close(semi_files[a1]) == 0) {
+      semi_files.erase(a1);
+      result = 0;
+    }
+    break;
+  case _semi_clock: {
+    // microseconds of host wall clock, high word in r2
+    uint64_t us = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    result = static_cast<uint32_t>(us);
+    regs[_r2] = static_cast<uint32_t>(us >> 32);
+    break;
+  }
+  case _semi_exit:
+    exit_status = a1;
+    exited = true;
+    stopped = true;
+    result = a1;
+    break;
+  default:
+    break;
+  }
+  regs[_r1] = result;
+}
+
+
+uint32_t Emulator::semi_transfer(uint32_t handle, uint32_t buf, uint32_t len, bool to_host) {
+  if(semi_files.count(handle) == 0)
+    return 0xFFFFFFFF;
+  int fd = semi_files[handle];
+  // emulator output goes through cout, so guest output to stdout and stderr must go there too
+  if(to_host && (fd == 1 || fd == 2))
+    (fd == 1 ? cout : cerr).flush();
+  vector<uint8_t> chunk(min<uint32_t>(len, _semi_chunk));
+  uint32_t done = 0;
+  while(done < len) {
+    uint32_t n = min<uint32_t>(len - done, _semi_chunk);
+    ssize_t moved;
+    if(to_host) {
+      dma_from_memory(buf + done, chunk.data(), n);
+      moved = write(fd, chunk.data(), n);
+    } else {
+      moved = read(fd, chunk.data(), n);
+      if(moved > 0)
+        dma_to_memory(buf + done, chunk.data(), moved);
+    }
+    if(moved < 0)
+      return (done > 0) ? done : 0xFFFFFFFF;
+    done += moved;
+    if(moved < n)
+      break;
+  }
+  return done;
+}
+
+
+uint32_t Emulator::semi_open(uint32_t path, uint32_t mode) {
+  string name;
+  for(uint32_t i = 0; i < _semi_max_path; i++) {
+    char ch = static_cast<char>(read_byte(path + i));
+    if(ch == '\0')
+      break;
+    name += ch;
+  }
+  int flags = (mode == _semi_open_read) ? O_RDONLY : ((mode == _semi_open_write) ? (O_WRONLY | O_CREAT | O_TRUNC) :
+    ((mode == _semi_open_append) ? (O_WRONLY | O_CREAT | O_APPEND) : -1));
+  if(flags == -1 || name.empty())
+    return 0xFFFFFFFF;
+  int fd = open(name.c_str(), flags, 0644);
+  if(fd < 0)
+    return 0xFFFFFFFF;
+  semi_files[next_semi_file] = fd;
+  return next_semi_file++;
+}
+
+
+BlockDevice::BlockDevice(string fileName) : fd(-1), data(nullptr), size(0), status(0), sector(0), count(0), dma(0) {
+  fd = open(fileName.c_str(), O_RDWR);
+  if(fd < 0)
+    throw CustomException("*EE : Block device file not open");
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size < _blk_sector_size) {
+    close(fd);
+    throw CustomException("*EE : Block device file must hold at least one sector");
+  }
+  // partial last sector is not visible to guest
+  size = (static_cast<uint64_t>(st.st_size) / _blk_sector_size) * _blk_sector_size;
+  void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(mapping == MAP_FAILED) {
+    close(fd);
+    throw CustomException("*EE : Block device file could not be mapped");
+  }
+  data = static_cast<uint8_t *>(mapping);
+}
+
+
+BlockDevice::~BlockDevice() {
+  munmap(data, size);
+  close(fd);
+}
+
+
+void BlockDevice::flush() {
+  if(msync(data, size, MS_SYNC) != 0)
+    status |= _blk_status_error;
+}
+// *****************************************************************************************************
+
+// *****************************************************************************************************
+// Instrumentation plugins
+DynamicPlugin::DynamicPlugin(string spec) : handle(nullptr) {
+  // <file.so>[:<args>], args are handed to plugin as they are
+  string file = spec.substr(0, spec.find(":"));
+  string args = (spec.find(":") != string::npos) ? spec.substr(spec.find(":") + 1) : "";
+  if(file.find("/") == string::npos)
+    file = "./" + file;
+  memset(&hooks, 0, sizeof(hooks));
+  handle = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if(handle == nullptr) {
+    cerr << dlerror() << endl;
+    throw CustomException("*EE : Plugin could not be loaded");
+  }
+  emu_plugin_init_t init = reinterpret_cast<emu_plugin_init_t>(dlsym(handle, EMU_PLUGIN_INIT));
+  if(init == nullptr) {
+    dlclose(handle);
+    throw CustomException("*EE : Plugin has no emu_plugin_init");
+  }
+  if(init(&hooks, args.c_str()) != 0) {
+    dlclose(handle);
+    throw CustomException("*EE : Plugin refused to load");
+  }
+}
+
+
+DynamicPlugin::~DynamicPlugin() {
+  if(handle != nullptr)
+    dlclose(handle);
+}
+
+
+InstProfiler::InstProfiler(string file) : per_oc(), branches(0), loads(0), stores(0), interrupts(0) {
+  if(!file.empty()) {
+    outFile.open(file, ios::out | ios::trunc);
+    if(!outFile.is_open())
+      throw CustomException("*EE : Profile file not open");
+  }
+}
+
+
+void InstProfiler::finish() {
+  static const char *oc_names[] = {"halt", "int", "call", "jmp", "xchg", "aritm", "logic", "shift", "store", "load"};
+  ostream &out = outFile.is_open() ? outFile : cout;
+  out << "------------------------------------------------------------------" << endl;
+  out << "Instruction profile" << endl;
+  for(int i = 0; i < 10; i++)
+    if(per_oc[i] != 0)
+      out << dec << setw(10) << setfill(' ') << per_oc[i] << "  " << oc_names[i] << endl;
+  out << dec << setw(10) << setfill(' ') << branches << "  taken branches" << endl;
+  out << setw(10) << loads << "  loads" << endl;
+  out << setw(10) << stores << "  stores" << endl;
+  out << setw(10) << interrupts << "  interrupts" << endl;
+}
+// *****************************************************************************************************
+
+// *****************************************************************************************************
+// Lockstep lanes
+vector<string> Lockstep::read_lanes(string lanesFile) {
+  // one lane per line : <address|symbol>=<value> ..., or - for unchanged image
+  ifstream lanesInput(lanesFile, ios::in);
+  if(!lanesInput.is_open())
+    throw CustomException("*EE : Lanes file not open");
+  vector<string> lanePatches;
+  string line;
+  while(getline(lanesInput, line))
+    if(line.find_first_not_of(" \t\r") != string::npos && line[line.find_first_not_of(" \t")] != '#')
+      lanePatches.push_back(line);
+  return lanePatches;
+}
+
+
+Lockstep::Lockstep(string inFileName, vector<string> options, const vector<string> &lanePatches, const Emulator &ref) : pc(pc_start_addr) {
+  for(auto& line : lanePatches) {
+    lanes.push_back(unique_ptr<Emulator>(new Emulator(inFileName, options)));
+    Emulator &lane = *lanes.back();
+    // step_group hands lane only operand registers of scalar instruction, see there
+    if(lane.semihost_on || lane.block || !lane.plugin_spec.empty() || lane.profile_on)
+      throw CustomException("*EE : Lockstep lanes support only interrupt options");
+    lane.symbols = ref.symbols;
+    lane.sym_addrs = ref.sym_addrs;
+    *lane.pc = pc_start_addr;
+    lane.fill_memory();
+    // patches common to all lanes first, then ones of this lane
+    for(int i = 0; i < lane.patches.size(); i++)
+      lane.apply_patch(lane.patches[i]);
+    for(auto& patch : lane.divide_line(line, SPACE_CHAR))
+      if(!patch.empty() && patch != "-")
+        lane.apply_patch(patch);
+  }
+  if(lanes.empty())
+    throw CustomException("*EE : Lanes file has no lanes");
+  num_lanes = lanes.size();
+  regs.assign(_num_regs * num_lanes, 0);
+  halted.assign(num_lanes, false);
+  errors.assign(num_lanes, "");
+  for(int k = 0; k < num_lanes; k++)
+    active.push_back(k);
+}
+
+
+void Lockstep::regs_to_lane(int lane) {
+  for(int r = _r1; r < _pc; r++)
+    lanes[lane]->regs[r] = regs[r * num_lanes + lane];
+}
+
+
+void Lockstep::sync_to_lane(int lane) {
+  regs_to_lane(lane);
+  *lanes[lane]->pc = pc;
+}
+
+
+void Lockstep::drop_lane(int lane) {
+  sync_to_lane(lane);
+  active.erase(find(active.begin(), active.end(), lane));
+}
+
+
+template<typename Op>
+void Lockstep::lanes_op(int regA, int regB, int regC, Op op) {
+  // rows are contiguous, so with -O3 compiler turns this into host SIMD. Plain -g build of build.sh
+  // stays scalar.
+  // Lane count is read once, stores to rows could otherwise change it.
+  const int n = num_lanes;
+  uint32_t *a = &regs[regA * n];
+  const uint32_t *b = &regs[regB * n];
+  const uint32_t *c = &regs[regC * n];
+  for(int k = 0; k < n; k++)
+    a[k] = op(b[k], c[k]);
+}
+
+
+bool Lockstep::vector_op(Emulator &lead) {
+  // pc as operand or destination, writes to r0 and division (trap on zero) stay scalar
+  if(lead.regA == _r0 || lead.regA >= _pc || lead.regB >= _pc || lead.regC >= _pc)
+    return false;
+  int a = lead.regA, b = lead.regB, c = lead.regC;
+  switch(lead.oc) {
+    case '5':
+      switch(lead.mod) {
+        case '0': lanes_op(a, b, c, [](uint32_t x, uint32_t y) { return x + y; }); return true;
+        case '1': lanes_op(a, b, c, [](uint32_t x, uint32_t y) { return x - y; }); return true;
+        case '2': lanes_op(a, b, c, [](uint32_t x, uint32_t y) { return x * y; }); return true;
+      }
+      return false;
+    case '6':
+      switch(lead.mod) {
+        case '0': lanes_op(a, b, c, [](uint32_t x, uint32_t y) { return ~x; }); return true;
+        case '1': lanes_op(a, b, c, [](uint32_t x, uint32_t y) { return x & y; }); return true;
+        case '2': lanes_op(a, b, c, [](uint32_t x, uint32_t y) { return x | y; }); return true;
+        case '3': lanes_op(a, b, c, [](uint32_t x, uint32_t y) { return x ^ y; }); return true;
+      }
+      return false;
+    // host shifts use count modulo 32, same as scalar path
+    case '7':
+      switch(lead.mod) {
+        case '0': lanes_op(a, b, c, [](uint32_t x, uint32_t y) { return x << (y & 31); }); return true;
+        case '1': lanes_op(a, b, c, [](uint32_t x, uint32_t y) { return x >> (y & 31); }); return true;
+      }
+      return false;
+  }
+  return false;
+}
+
+
+bool Lockstep::step_group() {
+  // one instruction of the group, false once no lane is left in it
+  s_NoTiming timing;
+  if(!active.empty()) {
+    Emulator &lead = *lanes[active[0]];
+    uint32_t inst = lead.read_memory(pc);
+    for(int i = active.size() - 1; i > 0; i--)
+      if(lanes[active[i]]->read_memory(pc) != inst)
+        drop_lane(active[i]);
+    *lead.pc = pc;
+    try {
+      lead.decode_pc_instruction();
+    } catch(const CustomException &e) {
+      for(int i = 0; i < active.size(); i++)
+        errors[active[i]] = e.what();
+      active.clear();
+      return false;
+    }
+    if(lead.oc == '0') {
+      // whole group halts, state is printed per lane below
+      pc = *lead.pc;
+      for(int i = 0; i < active.size(); i++) {
+        sync_to_lane(active[i]);
+        halted[active[i]] = true;
+      }
+      active.clear();
+      return false;
+    }
+    if((lead.oc == '5' || lead.oc == '6' || lead.oc == '7') && vector_op(lead)) {
+      pc += WORD_SIZE;
+      for(int i = 0; i < active.size(); i++)
+        lanes[active[i]]->inst_count++;
+      return true;
+    }
+    // scalar instruction (interrupt entry included) touches only its operand registers and sp, so
+    // only their rows go to lane and back. Rest of lane's registers is brought up to date when it leaves.
+    // This holds only because lanes have no semihosting, whose host call is a store that reads r1-r3
+    // and writes r1 and r2. Lockstep constructor refuses it, together with block device and plugins.
+    const int used[] = {lead.regA, lead.regB, lead.regC, _sp};
+    for(int i = active.size() - 1; i >= 0; i--) {
+      int k = active[i];
+      Emulator &lane = *lanes[k];
+      for(int r : used)
+        if(r > _r0 && r < _pc)
+          lane.regs[r] = regs[r * num_lanes + k];
+      *lane.pc = pc;
+      try {
+        lane.step(timing);
+      } catch(const CustomException &e) {
+        errors[k] = e.what();
+        active.erase(active.begin() + i);
+        continue;
+      }
+      for(int r : used)
+        if(r > _r0 && r < _pc)
+          regs[r * num_lanes + k] = lane.regs[r];
+    }
+    if(active.empty())
+      return false;
+    // lanes that branched elsewhere go on alone with their own registers
+    pc = *lanes[active[0]]->pc;
+    for(int i = active.size() - 1; i > 0; i--)
+      if(*lanes[active[i]]->pc != pc) {
+        regs_to_lane(active[i]);
+        active.erase(active.begin() + i);
+      }
+  }
+  return !active.empty();
+}
+
+
+void Lockstep::report() {
+  s_NoTiming timing;
+  for(int k = 0; k < num_lanes; k++) {
+    cout << "Lane " << dec << k << endl;
+    Emulator &lane = *lanes[k];
+    try {
+      if(!errors[k].empty())
+        cout << errors[k] << endl;
+      else if(halted[k])
+        lane.do_halt();
+      else 
+        do {
+          lane.step(timing);
+        } while(lane.oc != '0');
+    } catch(const CustomException &e) {
+      cout << e.what() << endl;
+    }
+  }
+}
+
+
+void Lockstep::run() {
+  while(step_group());
+  report();
+}
+// *****************************************************************************************************
+
+// *****************************************************************************************************
+// Differential verification
+// Alternate engine is lockstep engine with one lane, its aritmetic, logic and shift
+// instructions run through vector path instead of reference do_* functions.
+Verifier::Verifier(Emulator &ref, vector<string> options, uint64_t interval) : ref(ref),
+  alt(ref.inFileName, options, vector<string>(1, "-"), ref), interval(interval) {
+  ref.start_dirty_tracking();
+  alt.lanes[0]->start_dirty_tracking();
+}
+
+
+uint32_t Verifier::alt_reg(int regNo) {
+  Emulator &lane = *alt.lanes[0];
+  bool grouped = !alt.active.empty();
+  if(regNo == _pc)
+    return grouped ? alt.pc : *lane.pc;
+  if(regNo == _r0 || !grouped)
+    return lane.regs[regNo];
+  return alt.regs[regNo * alt.num_lanes];
+}
+
+
+bool Verifier::compare(uint32_t inst_pc) {
+  Emulator &lane = *alt.lanes[0];
+  vector<string> diffs;
+  stringstream ss;
+  for(int r = _r0; r <= _pc; r++)
+    if(ref.regs[r] != alt_reg(r)) {
+      ss.str("");
+      ss << "     r" << dec << r << " : 0x" << hex << setw(8) << setfill('0') << ref.regs[r]
+        << " != 0x" << setw(8) << setfill('0') << alt_reg(r);
+      diffs.push_back(ss.str());
+    }
+  for(int r = _status; r <= _cause; r++)
+    if(ref.control_regs[r] != lane.control_regs[r]) {
+      ss.str("");
+      ss << "     csr" << dec << r << " : 0x" << hex << setw(8) << setfill('0') << ref.control_regs[r]
+        << " != 0x" << setw(8) << setfill('0') << lane.control_regs[r];
+      diffs.push_back(ss.str());
+    }
+  // only pages written by either engine since last compare
+  set<uint32_t> written(ref.dirty_pages.begin(), ref.dirty_pages.end());
+  written.insert(lane.dirty_pages.begin(), lane.dirty_pages.end());
+  for(auto page : written)
+    for(uint32_t addr = page; addr - page < _page_size; addr += WORD_SIZE)
+      if(ref.read_memory(addr) != lane.read_memory(addr)) {
+        ss.str("");
+        ss << "     mem[0x" << hex << setw(8) << setfill('0') << addr << "] : 0x" << setw(8) << setfill('0') << ref.read_memory(addr)
+          << " != 0x" << setw(8) << setfill('0') << lane.read_memory(addr);
+        diffs.push_back(ss.str());
+      }
+  if(diffs.empty()) {
+    // re-arm pages so next compare again sees only new writes
+    for(auto page : written) {
+      ref.get_page_entry(page).flags |= _page_verify;
+      lane.get_page_entry(page).flags |= _page_verify;
+    }
+    ref.dirty_pages.clear();
+    lane.dirty_pages.clear();
+    return true;
+  }
+  uint32_t inst = ref.read_memory(inst_pc);
+  cout << "Engines diverge after " << dec << ref.inst_count << " instructions, last instruction at pc "
+    << Emulator::symbolize(ref.symbols, inst_pc) << " :";
+  for(int i = 0; i < WORD_SIZE; i++)
+    cout << " " << hex << setw(2) << setfill('0') << ((inst >> (8 * i)) & 0xFF);
+  cout << endl << "reference != alternate" << endl;
+  for(auto& diff : diffs)
+    cout << diff << endl;
+  return false;
+}
+
+
+void Verifier::run() {
+  s_NoTiming timing;
+  uint64_t since_compare = 0;
+  while(true) {
+    uint32_t inst_pc = *ref.pc;
+    string ref_error;
+    try {
+      ref.step(timing);
+    } catch(const CustomException &e) {
+      ref_error = e.what();
+    }
+    bool alt_running = alt.step_group();
+    bool ref_done = !ref_error.empty() || ref.oc == '0';
+    if(ref_error != alt.errors[0] || ref_done == alt_running) {
+      cout << "Engines diverge after " << dec << ref.inst_count << " instructions, last instruction at pc "
+        << Emulator::symbolize(ref.symbols, inst_pc) << endl;
+      cout << "reference : " << (!ref_error.empty() ? ref_error : (ref_done ? "halted" : "running")) << endl;
+      cout << "alternate : " << (!alt.errors[0].empty() ? alt.errors[0] : (alt_running ? "running" : "halted")) << endl;
+      return;
+    }
+    // block ends where pc does not move to next word, or every interval instructions
+    bool boundary = (interval == 0) ? (*ref.pc != inst_pc + WORD_SIZE) : (++since_compare >= interval);
+    if(boundary || ref_done) {
+      since_compare = 0;
+      if(!compare(inst_pc))
+        return;
+    }
+    if(ref_done) {
+      if(!ref_error.empty())
+        cout << ref_error << endl;
+      break;
+    }
+  }
+  cout << "Engines match after " << dec << ref.inst_count << " instructions" << endl;
+}
+
+// *****************************************************************************************************
+
 int main(int argc, const char *argv[]){
 
+  int status = 0;
   try {
-    // string inFile = argv[2]; // for debug
-    string inFile = argv[1]; // for use
+    string inFile = "";
+    vector<string> options = vector<string>();
+    for(int i = 1; i < argc; i++) {
+      string arg = argv[i];
+      if(arg[0] == '-')
+        options.push_back(arg);
+      else 
+        inFile = arg;
+    }
+    if(inFile.empty())
+      throw CustomException("*EE : Input file not specified");
 
-    Emulator emu(inFile);
+    Emulator emu(inFile, options);
 
     emu.pass();
+    // status given by guest through semihosting exit, 0 otherwise
+    status = emu.get_exit_status();
     
   } catch(const std::exception &e){
     cerr << e.what() << endl;
   }
 
 
-  return 0;
+  return status;
 }
\ No newline at end of file
@@ -1,175 +1,373 @@
 #include "../inc/linker.hpp"
 
 
-Linker::Linker(string outFile, vector<string> inFiles, vector<string> addr_places) : outFileName(outFile), inFileNames(inFiles), address_places(addr_places) {
-  for(int i = 0; i < inFileNames.size(); i++) {
-    inputFiles.push_back(ifstream());
-    inputFiles[i].open(inFileNames[i], ios::binary);
-    if(!inputFiles[i].is_open())
-      throw CustomException("*LE : Failed to open input file");
-  }
+Linker::Linker(string outFile, vector<string> inFiles, vector<string> arFiles, vector<string> addr_places, int jobs, bool listing, bool best_fit) : outFileName(outFile), inFileNames(inFiles), address_places(addr_places), jobs(jobs), best_fit(best_fit), listing(listing), gc_sections(false), merge_literals(false) {
+  if(this->jobs <= 0)
+    this->jobs = max(1u, thread::hardware_concurrency());
+  archives.resize(arFiles.size());
+  for(int i = 0; i < arFiles.size(); i++)
+    archives[i].name = arFiles[i];
   outputFile.open(outFileName, ios::out | ios::trunc);
   if(!outputFile.is_open())
     throw CustomException("*LE : Failed to open output file");
   
-  string hlpFile = outFileName.substr(0, outFileName.length() - 4);
-  hlpFile.append(".txt");
-  helperFile.open(hlpFile, ios::out | ios::trunc);
-  if(!helperFile.is_open())
-    throw CustomException("*LE : Failed to open helper file");
+  if(listing) {
+    string hlpFile = outFileName.substr(0, outFileName.length() - 4);
+    hlpFile.append(".txt");
+    helperFile.open(hlpFile, ios::out | ios::trunc);
+    if(!helperFile.is_open())
+      throw CustomException("*LE : Failed to open helper file");
+  }
+
+  string symMapFile = outFileName.substr(0, outFileName.length() - 4);
+  symMapFile.append(".sym");
+  symFile.open(symMapFile, ios::out | ios::trunc);
+  if(!symFile.is_open())
+    throw CustomException("*LE : Failed to open symbol map file");
 }
 
 
 Linker::~Linker(){
-  for(int i = 0; i < inFileNames.size(); i++) {
-    inputFiles[i].close();
-  }
   outputFile.close();
   helperFile.close();
+  symFile.close();
 }
 // *********************************************************************************************************************
 // Linker functions
 void Linker::first_pass() {
-  for(int i = 0; i < inputFiles.size(); i++){
-    read_file(i);
+  // Files are mapped and parsed in parallel, then merged into linker tables in command line order,
+  // so section and symbol indices (and output) are same as when loading one file after another
+  int num = inFileNames.size();
+  inputFiles.resize(num);
+  inputData.resize(num);
+  inputTables.resize(num);
+  file_info.resize(num);
+  run_parallel(num, [this](int i) { parse_file(i); });
+
+  for(int i = 0; i < num; i++){
+    load_sections_from_file(i);
+    // names stay in mapping, parsed tables are no longer needed
+    inputTables[i] = s_InputTables();
   }
+  extract_archive_members();
 }
 
 
-void Linker::second_pass(){
-  is_input_correct();
-  for(auto& elem : sec_address) {
-    sections[sec_name_ndx[elem.first]].sh_addr = static_cast<uint32_t> (elem.second);
-    insert_sorted_to_vect(used_addresses, static_cast<uint32_t> (elem.second));
-    addr_size.insert(make_pair(static_cast<uint32_t>(elem.second), sections[sec_name_ndx[elem.first]].sh_size));
-  }
-  for(int i = 0; i < sections.size(); i++) {
-    if(sections[i].sh_type == SHT_PROGBITS && sections[i].sh_addr == 0) {
-      bool isTherePlace;
-      uint32_t start_addr = find_start_addr(i, isTherePlace);
-      if(isTherePlace)
-        sections[i].sh_addr = start_addr;
-      else 
-        throw CustomException("*LE : There is no place to store section");
+// Members of archives are pulled in only to define symbols that are still undefined, archives are
+// searched in command line order. Pulled members can leave new undefined symbols, so it goes on
+// until a round pulls nothing. Every symbol is looked up once, when it is first seen undefined.
+void Linker::extract_archive_members() {
+  if(archives.empty())
+    return;
+  run_parallel(archives.size(), [this](int i) { load_archive(i); });
+  int scanned = 1;
+  while(true) {
+    vector<pair<int, uint32_t>> wanted;
+    for(; scanned < symTbl.size(); scanned++) {
+      if(symTbl[scanned].sym_ndx != 0 || symTbl[scanned].sym_type == STT_SECTION)
+        continue;
+      uint32_t member;
+      for(int arNdx = 0; arNdx < archives.size(); arNdx++) {
+        if(!find_in_archive(arNdx, find_name_by_sym_ndx(scanned), member))
+          continue;
+        if(!archives[arNdx].extracted[member]) {
+          archives[arNdx].extracted[member] = 1;
+          wanted.push_back(make_pair(arNdx, member));
+        }
+        break;
+      }
+    }
+    if(wanted.empty())
+      break;
+
+    int first = inFileNames.size();
+    for(auto& elem : wanted) {
+      const s_Archive &ar = archives[elem.first];
+      s_ByteView entry = ar.members.sub(elem.second * sizeof(s_ArMember), sizeof(s_ArMember));
+      string_view name = get_name_from_str_array(entry.read(offsetof(s_ArMember, am_name), sizeof(uint32_t)), ar.strings);
+      inFileNames.push_back(ar.name + "(" + string(name) + ")");
+      inputData.push_back(ar.file->view().sub(entry.read(offsetof(s_ArMember, am_offset), sizeof(uint64_t)),
+                                              entry.read(offsetof(s_ArMember, am_size), sizeof(uint64_t))));
+      inputFiles.emplace_back();
+      inputTables.emplace_back();
+      file_info.emplace_back();
+    }
+    run_parallel(wanted.size(), [this, first](int i) { parse_file(first + i); });
+    for(int i = first; i < inFileNames.size(); i++) {
+      load_sections_from_file(i);
+      inputTables[i] = s_InputTables();
     }
   }
-  helperFile << "Sym values:" << endl << setw(5) << setfill(' ') << "Ndx: " << setw(25) << setfill(' ') << "Name: " << setw(25) << setfill(' ') << "Value: " << endl;
-  for(int i = 0; i < symTbl.size(); i++) {
-    sym_vals.insert(make_pair(i, sections[symTbl[i].sym_ndx].sh_addr + symTbl[i].sym_value));
-    helperFile << setw(5) << setfill(' ') << i << setw(25) << setfill(' ') << find_name_by_sym_ndx(i) << setw(25) << setfill(' ') << hex << sym_vals[i] << endl;
+}
+
+
+void Linker::load_archive(int arNdx) {
+  s_Archive &ar = archives[arNdx];
+  ar.file.reset(new MappedFile(ar.name));
+  s_ByteView hdr = ar.file->view().sub(0, sizeof(s_ArHdr));
+  if(memcmp(hdr.data + offsetof(s_ArHdr, ar_magic), AR_MAGIC, AR_MAGIC_SIZE) != 0)
+    throw CustomException("*LE : Input file is not an archive");
+  ar.num_members = hdr.read(offsetof(s_ArHdr, ar_members), sizeof(uint32_t));
+  ar.num_symbols = hdr.read(offsetof(s_ArHdr, ar_symbols), sizeof(uint32_t));
+  ar.num_buckets = hdr.read(offsetof(s_ArHdr, ar_buckets), sizeof(uint32_t));
+  if(ar.num_buckets == 0 || (ar.num_buckets & (ar.num_buckets - 1)) != 0)
+    throw CustomException("*LE : Malformed archive symbol index");
+  ar.members = ar.file->view().sub(hdr.read(offsetof(s_ArHdr, ar_memoff), sizeof(uint64_t)), static_cast<uint64_t>(ar.num_members) * sizeof(s_ArMember));
+  ar.symbols = ar.file->view().sub(hdr.read(offsetof(s_ArHdr, ar_symoff), sizeof(uint64_t)), static_cast<uint64_t>(ar.num_symbols) * sizeof(s_ArSym));
+  ar.buckets = ar.file->view().sub(hdr.read(offsetof(s_ArHdr, ar_bucketoff), sizeof(uint64_t)), static_cast<uint64_t>(ar.num_buckets) * sizeof(uint32_t));
+  ar.strings = ar.file->view().sub(hdr.read(offsetof(s_ArHdr, ar_stroff), sizeof(uint64_t)), hdr.read(offsetof(s_ArHdr, ar_strsize), sizeof(uint64_t)));
+  ar.extracted.assign(ar.num_members, 0);
+}
+
+
+// Member that defines symbol, from chain of its hash bucket. Names are compared only on equal hash.
+bool Linker::find_in_archive(int arNdx, string_view name, uint32_t &member) {
+  const s_Archive &ar = archives[arNdx];
+  uint64_t hash = ar_hash(name.data(), name.size());
+  uint32_t ndx = ar.buckets.read((hash & (ar.num_buckets - 1)) * sizeof(uint32_t), sizeof(uint32_t));
+  // chain can't be longer than index, bound stops loops of corrupted archive
+  for(uint32_t steps = 0; ndx != AR_NO_SYM && steps < ar.num_symbols; steps++) {
+    s_ByteView sym = ar.symbols.sub(static_cast<uint64_t>(ndx) * sizeof(s_ArSym), sizeof(s_ArSym));
+    if(sym.read(offsetof(s_ArSym, as_hash), sizeof(uint64_t)) == hash &&
+       get_name_from_str_array(sym.read(offsetof(s_ArSym, as_name), sizeof(uint32_t)), ar.strings) == name) {
+      member = sym.read(offsetof(s_ArSym, as_member), sizeof(uint32_t));
+      if(member >= ar.num_members)
+        throw CustomException("*LE : Malformed archive symbol index");
+      return true;
+    }
+    ndx = sym.read(offsetof(s_ArSym, as_next), sizeof(uint32_t));
   }
+  return false;
+}
+
+
+void Linker::second_pass(){
+  parse_places();
+  if(gc_sections)
+    collect_garbage();
+  // after collection, dropped parts can't hold entries others would share
+  if(merge_literals)
+    merge_literal_pools();
+  is_input_correct();
+  place_sections();
+  resolve_symbols();
+  if(listing)
+    print_sym_values();
   for(int i = 1; i < symTbl.size(); i++) {
     if(symTbl[i].sym_ndx == 0) {
       cout << "Symbol : " << find_name_by_sym_ndx(i) << " is undefined" << endl;
       throw CustomException("*LE : Undefined symbol");
     }
   }
-  for(auto& elem : reloc){
-    for(int i = 0; i < elem.second.size(); i++) {
-      // int secNdx = symTbl[elem.second[i].r_symval].sym_ndx;
-      // for(int j = 0; j < elem.second[i].r_size / _HALF_BYTE; j++) {
-      //   sec_content.at(elem.first)[elem.second[i].r_offset + j * WORD_SIZE] = ((sym_vals[elem.second[i].r_symval] & (__MASK_0_3 << j * WORD_SIZE)) >> (j * WORD_SIZE));
-      // }
-      uint32_t temp = sym_vals[elem.second[i].r_symval] + elem.second[i].r_addend;
-      uint32_t mask = static_cast<uint32_t>((0xffffffff << elem.second[i].r_size));
-      temp = temp & mask;
-      sec_content.at(elem.first)[elem.second[i].r_offset + 0] = __GET_BITS_0_7(temp);
-      sec_content.at(elem.first)[elem.second[i].r_offset + 1] = __GET_BITS_8_15(temp);
-      sec_content.at(elem.first)[elem.second[i].r_offset + 2] = __GET_BITS_16_23(temp);
-      sec_content.at(elem.first)[elem.second[i].r_offset + 3] = __GET_BITS_24_31(temp);
-    }
-  }
-  uint32_t addr = 0;
-  string line = addr + ": ";
-  outputFile << setw(8) << hex << addr << ": ";
-  for(int i = 0; i < used_addresses.size(); i++) {
-    int secNdx = find_section_start_on_addr(used_addresses[i]);
-    addr = sections[secNdx].sh_addr;
-    if(sec_content.count(secNdx) > 0) {
-      // uint32_t lower = 0;
-      // uint32_t higher = 0;
-      for(int j = 0; j < sec_content.at(secNdx).size(); j++) {
-        if(addr % _BYTE_SIZE == 0 && addr != 0) 
-          outputFile << endl << setw(8) << hex << addr << ": ";
-        outputFile << charToHexString(sec_content.at(secNdx)[j]) << " ";
-        addr++;
-        // outputFile << setw(8) << addr << ": ";
-        // __SET_BITS_24_31(lower, sec_content.at(secNdx)[j++]);
-        // __SET_BITS_16_23(lower, sec_content.at(secNdx)[j++]);
-        // __SET_BITS_8_15(lower, sec_content.at(secNdx)[j++]);
-        // __SET_BITS_0_7(lower, sec_content.at(secNdx)[j++]);
-        // outputFile << hex << lower << " ";
-        // __SET_BITS_24_31(higher, sec_content.at(secNdx)[j++]);
-        // __SET_BITS_16_23(higher, sec_content.at(secNdx)[j++]);
-        // __SET_BITS_8_15(higher, sec_content.at(secNdx)[j++]);
-        // __SET_BITS_0_7(higher, sec_content.at(secNdx)[j++]);
-        // outputFile << hex << higher << endl;
-      }
-    }
-  }
+  // sections don't share content, so each one is patched by its own worker
+  vector<int> relocated;
+  for(int i = 0; i < reloc.size(); i++)
+    if(!reloc[i].empty())
+      relocated.push_back(i);
+  run_parallel(relocated.size(), [this, &relocated](int i) { apply_relocations(relocated[i], 0, reloc[relocated[i]].size()); });
+  write_hex();
+}
+
+
+void Linker::resolve_symbols() {
+  sym_vals.resize(symTbl.size());
+  for(int i = 0; i < symTbl.size(); i++)
+    sym_vals[i] = sections[symTbl[i].sym_ndx].sh_addr + symTbl[i].sym_value;
+}
+
+
+void Linker::write_hex() {
+  // Line breaks depend only on address of each byte, so sections are formatted independently
+  // and written one after another in address order
+  vector<string> hex_text(layout.size());
+  run_parallel(layout.size(), [this, &hex_text](int i) {
+    format_hex(sec_content[layout[i].second], layout[i].first, hex_text[i]);
+  });
+  outputFile << setw(8) << hex << 0 << ": ";
+  for(auto& text : hex_text)
+    outputFile.write(text.data(), text.size());
 }
 
-string Linker::charToHexString(char ch) {
-    std::stringstream stream;
-    stream << std::hex << std::setw(4) << std::setfill('0') << static_cast<uint16_t>(ch);
-    return stream.str().substr(2);
+
+void Linker::format_hex(const vector<char> &content, uint32_t addr, string &out) {
+  static const char digits[] = "0123456789abcdef";
+  static const auto byte_hex = []() {
+    array<array<char, 2>, 256> table;
+    for(int i = 0; i < 256; i++)
+      table[i] = {digits[i >> 4], digits[i & 0xf]};
+    return table;
+  }();
+  // 3 chars per byte, 11 more per line header
+  out.resize(content.size() * 3 + (content.size() / _BYTE_SIZE + 1) * 11);
+  char *dst = &out[0];
+  for(char ch : content) {
+    if(addr % _BYTE_SIZE == 0 && addr != 0) {
+      *dst++ = '\n';
+      // address right aligned in 8 chars, same as setw(8) << hex
+      char *end = dst + 8;
+      uint32_t val = addr;
+      do {
+        *--end = digits[val & 0xf];
+        val >>= 4;
+      } while(val != 0);
+      while(end > dst)
+        *--end = ' ';
+      dst += 8;
+      *dst++ = ':';
+      *dst++ = ' ';
+    }
+    const array<char, 2> &hex_pair = byte_hex[static_cast<uint8_t>(ch)];
+    *dst++ = hex_pair[0];
+    *dst++ = hex_pair[1];
+    *dst++ = ' ';
+    addr++;
+  }
+  out.resize(dst - out.data());
 }
 
 // *********************************************************************************************************************
 
 // *********************************************************************************************************************
 // Helper functions
-int Linker::find_section_start_on_addr(uint32_t addr){
-  for(int i = 1; i < sections.size(); i++)
-    if(sections[i].sh_addr == addr)
-      return i;
-  return -1;
+// Runs work(i) for every i in [0, num) on up to jobs threads. Exception of lowest i is rethrown
+// after all workers are done, so reported error doesn't depend on scheduling.
+template<typename Work>
+void Linker::run_parallel(int num, Work work) {
+  vector<exception_ptr> errors(num);
+  atomic<int> next(0);
+  auto worker = [&]() {
+    for(int i = next++; i < num; i = next++) {
+      try {
+        work(i);
+      } catch(...) {
+        errors[i] = current_exception();
+      }
+    }
+  };
+  vector<thread> pool;
+  for(int i = 1; i < min(jobs, num); i++)
+    pool.push_back(thread(worker));
+  worker();
+  for(auto& t : pool)
+    t.join();
+  for(auto& error : errors)
+    if(error)
+      rethrow_exception(error);
 }
 
 
-void Linker::insert_sorted_to_vect(vector<uint32_t> &vect, uint32_t data) {
-  auto it = lower_bound(vect.begin(), vect.end(), data);
-  vect.insert(it, data);
+// Patches all relocations of one section. Offsets are checked when relocations are merged, and
+// mask keeps bits above r_size (shift count is modulo 32, so size 32 keeps whole word).
+void Linker::apply_relocations(int secNdx, size_t begin, size_t end, const vector<char> *moved) {
+  char *content = sec_content[secNdx].data();
+  const uint32_t *vals = sym_vals.data();
+  const s_Rela *rela = reloc[secNdx].data();
+  for(size_t i = begin; i < end; i++) {
+    const s_Rela &rel = rela[i];
+    if(moved != nullptr && !(*moved)[rel.r_symval])
+      continue;
+    uint32_t temp = (vals[rel.r_symval] + static_cast<uint32_t>(rel.r_addend)) & (0xffffffffu << (rel.r_size & 31));
+    char *dst = content + rel.r_offset;
+    dst[0] = __GET_BITS_0_7(temp);
+    dst[1] = __GET_BITS_8_15(temp);
+    dst[2] = __GET_BITS_16_23(temp);
+    dst[3] = __GET_BITS_24_31(temp);
+  }
+}
+
+// Sections from -place are reserved first (is_input_correct already checked they don't overlap),
+// others are allocated in section table order from what is left.
+void Linker::place_sections() {
+  AddressSpace space(0, ADDRESS_SPACE_END);
+  vector<bool> placed(sections.size(), false);
+  for(auto& elem : sec_address) {
+    int secNdx = sec_names.id(elem.first);
+    sections[secNdx].sh_addr = elem.second;
+    space.reserve(elem.second, sections[secNdx].sh_size);
+    placed[secNdx] = true;
+    layout.push_back(make_pair(elem.second, secNdx));
+  }
+  for(int i = 0; i < sections.size(); i++) {
+    if(sections[i].sh_type != SHT_PROGBITS || placed[i])
+      continue;
+    uint64_t start_addr;
+    if(!space.allocate(sections[i].sh_size, sections[i].sh_addralign, AUTO_PLACE_LIMIT, best_fit, start_addr)) {
+      cout << "Section : " << find_name_by_sec_ndx(i) << " of size " << dec << sections[i].sh_size << " doesn't fit in free address space" << endl;
+      throw CustomException("*LE : There is no place to store section");
+    }
+    sections[i].sh_addr = start_addr;
+    layout.push_back(make_pair(static_cast<uint32_t>(start_addr), i));
+  }
+  sort(layout.begin(), layout.end());
+}
+
+
+void AddressSpace::add_range(uint64_t start, uint64_t end) {
+  if(start >= end)
+    return;
+  free_ranges.insert(make_pair(start, end));
+  by_length.insert(make_pair(end - start, start));
 }
 
 
-uint32_t Linker::find_start_addr(int secNdx, bool &isTherePlace) {
-  uint32_t base_addr = 0;
-  if(used_addresses.size() == 0) {
-    insert_sorted_to_vect(used_addresses, base_addr);
-    addr_size.insert(make_pair(base_addr, sections[secNdx].sh_size));
-    isTherePlace = true;
-    return base_addr;
+// Removes [start, start + size) from free range, parts before and after it stay free
+void AddressSpace::take(map<uint64_t, uint64_t>::iterator range, uint64_t start, uint64_t size) {
+  uint64_t range_start = range->first;
+  uint64_t range_end = range->second;
+  by_length.erase(make_pair(range_end - range_start, range_start));
+  free_ranges.erase(range);
+  add_range(range_start, start);
+  add_range(start + size, range_end);
+}
+
+
+bool AddressSpace::reserve(uint64_t addr, uint64_t size) {
+  if(size == 0)
+    return true;
+  auto range = free_ranges.upper_bound(addr);
+  if(range == free_ranges.begin())
+    return false;
+  range--;
+  if(addr + size > range->second)
+    return false;
+  take(range, addr, size);
+  return true;
+}
+
+
+bool AddressSpace::allocate(uint64_t size, uint64_t align, uint64_t limit, bool best_fit, uint64_t &addr) {
+  // alignment 0 and 1 both mean byte aligned
+  align = max<uint64_t>(align, 1);
+  auto fits = [&](uint64_t start, uint64_t end) {
+    addr = (start + align - 1) / align * align;
+    return addr + size <= min(end, limit);
+  };
+  if(best_fit) {
+    // shortest interval first, padding for alignment can make it too short, then try next one
+    for(auto it = by_length.lower_bound(make_pair(size, 0)); it != by_length.end(); it++)
+      if(fits(it->second, it->second + it->first)) {
+        take(free_ranges.find(it->second), addr, size);
+        return true;
+      }
   } else {
-    for(int i = 0; i < used_addresses.size(); i++) {
-      if(base_addr + sections[secNdx].sh_size < used_addresses[i]) {
-        insert_sorted_to_vect(used_addresses, base_addr);
-        addr_size.insert(make_pair(base_addr, sections[secNdx].sh_size));
-        isTherePlace = true;
-        return base_addr;
+    for(auto it = free_ranges.begin(); it != free_ranges.end() && it->first < limit; it++)
+      if(fits(it->first, it->second)) {
+        take(it, addr, size);
+        return true;
       }
-      base_addr += addr_size[used_addresses[i]];
-    }
-    if(base_addr + sections[secNdx].sh_size < INT32_MAX) {
-      insert_sorted_to_vect(used_addresses, base_addr);
-      addr_size.insert(make_pair(base_addr, sections[secNdx].sh_size));
-      isTherePlace = true;
-      return base_addr;
-    }
-    isTherePlace = false;
-    return -1;
   }
+  return false;
 }
 
 
-void Linker::is_input_correct() {
+void Linker::parse_places() {
   for(int i = 0; i < address_places.size(); i++){
     string section = address_places[i].substr(address_places[i].find("=") + 1, address_places[i].find("@") - address_places[i].find("=") - 1);
-    if(sec_name_ndx.count(section) <= 0)
+    if(!sec_names.contains(section))
       throw CustomException("*LE : The section for which address was specified was not found");
     string address_str = address_places[i].substr(address_places[i].find("@") + 1);
     size_t pos;
-    int address = stoi(address_str, &pos);
+    uint32_t address = stoi(address_str, &pos);
     if(pos != address_str.size()) {
       address = stoul(address_str, &pos, 16);
       if(pos != address_str.size())
@@ -177,74 +375,444 @@ void Linker::is_input_correct() {
     }
     sec_address.insert(make_pair(section, address)); 
   }
-  for(auto &elem : sec_address) {
-    uint32_t next_addr = 0xffffffff;
-    string next_sec = "";
-    for(auto &it : sec_address) {
-      if(it.first != elem.first && it.second > elem.second && it.second < next_addr) {
-        next_addr = it.second;
-        next_sec = it.first;
-      }
+}
+
+
+void Linker::is_input_correct() {
+  // sorted by address, each section can only collide with the one after it
+  vector<pair<uint64_t, string>> order;
+  for(auto &elem : sec_address)
+    order.push_back(make_pair(elem.second, elem.first));
+  sort(order.begin(), order.end());
+  for(int i = 0; i < order.size(); i++) {
+    uint64_t end = order[i].first + sections[sec_names.id(order[i].second)].sh_size;
+    if(end > ADDRESS_SPACE_END) {
+      cout << "Linkage command line error, section : " << order[i].second << " placed at : " << hex << order[i].first << " of size : " << dec << sections[sec_names.id(order[i].second)].sh_size
+          << " ends past end of address space" << endl;
+      throw CustomException("*LE : Bad address alocation from cmd line");
     }
-    if(elem.second < next_addr && elem.second + sections[sec_name_ndx[elem.first]].sh_size - next_addr < 0) {
-      cout << "Linkage command line error, section : " << elem.first << " was designated to start from : " << hex << elem.second << " and its size is : " << dec <<  sections[sec_name_ndx[elem.first]].sh_size
-          << " but section : " << next_sec << " is starting from address : " << hex << next_addr << endl;
+    if(i + 1 < order.size() && end > order[i + 1].first) {
+      cout << "Linkage command line error, section : " << order[i].second << " occupies [" << hex << order[i].first << ", " << end << ") and section : " << order[i + 1].second
+          << " starting at : " << order[i + 1].first << " overlaps it by " << dec << (end - order[i + 1].first) << " bytes" << endl;
       throw CustomException("*LE : Bad address alocation from cmd line"); 
     }
   }
 }
 
+void Linker::enable_gc_sections(vector<string> keep) {
+  gc_sections = true;
+  keep_symbols = keep;
+}
+
+
+// Drops parts of sections (what one input file put into merged section) that can't be reached from
+// part at start address or parts defining keep_symbols through relocations. Live parts are moved
+// together, relocations, symbols and line entries follow them. Symbols of dropped parts, and
+// undefined symbols only dropped code refers to, are removed from symbol table. Records of parts in
+// file_info follow too, dropped parts are left empty.
+void Linker::collect_garbage() {
+  int files = inFileNames.size();
+  vector<map<int, int>> node_of(files);
+  vector<int> node_file;
+  vector<int> node_sec;
+  vector<uint64_t> node_base;
+  vector<uint64_t> node_size;
+  vector<vector<int>> sec_nodes(sections.size());
+  for(int f = 0; f < files; f++) {
+    for(auto& part : file_info[f].parts) {
+      if(part.second.sh_type != SHT_PROGBITS)
+        continue;
+      node_of[f][part.first] = node_file.size();
+      sec_nodes[part.first].push_back(node_file.size());
+      node_file.push_back(f);
+      node_sec.push_back(part.first);
+      node_base.push_back(file_info[f].sec_base.at(part.first));
+      node_size.push_back(part.second.sh_size);
+    }
+  }
+  auto find_node = [&node_of](int f, int secNdx) {
+    auto it = node_of[f].find(secNdx);
+    return (it != node_of[f].end()) ? it->second : -1;
+  };
+  // part symbol lives in, local references through section symbol point into part of same file
+  auto target_of = [&](int f, const s_Rela &rel) {
+    const s_SSym &sym = symTbl[rel.r_symval];
+    if(sym.sym_ndx == 0)
+      return -1;
+    return find_node((sym.sym_type == STT_SECTION && rel.r_addend != 0) ? f : sym_owner[rel.r_symval], sym.sym_ndx);
+  };
+
+  // relocations of each file, which are kept in command line order, are edges of its parts
+  vector<vector<int>> edges(node_file.size());
+  for(int secNdx = 0; secNdx < reloc.size(); secNdx++) {
+    size_t begin = 0;
+    for(int f = 0; f < files; f++) {
+      auto it = file_info[f].reloc_count.find(secNdx);
+      if(it == file_info[f].reloc_count.end())
+        continue;
+      int from = find_node(f, secNdx);
+      for(size_t i = begin; i < begin + it->second; i++) {
+        int to = target_of(f, reloc[secNdx][i]);
+        if(from >= 0 && to >= 0)
+          edges[from].push_back(to);
+      }
+      begin += it->second;
+    }
+  }
+
+  vector<int> work;
+  for(auto& elem : sec_address) {
+    int secNdx = sec_names.id(elem.first);
+    if(elem.second > START_ADDRESS || START_ADDRESS >= elem.second + sections[secNdx].sh_size)
+      continue;
+    for(int node : sec_nodes[secNdx])
+      if(node_base[node] <= START_ADDRESS - elem.second && START_ADDRESS - elem.second < node_base[node] + node_size[node])
+        work.push_back(node);
+  }
+  for(auto& name : keep_symbols) {
+    int symNdx = sym_names.find(name);
+    if(symNdx < 0 || symTbl[symNdx].sym_ndx == 0) {
+      cout << "Symbol : " << name << " given with -keep is not defined" << endl;
+      throw CustomException("*LE : Unknown symbol to keep");
+    }
+    int node = find_node(sym_owner[symNdx], symTbl[symNdx].sym_ndx);
+    if(node >= 0)
+      work.push_back(node);
+  }
+  if(work.empty())
+    throw CustomException("*LE : Nothing to start --gc-sections from, place section at start address or use -keep");
+  vector<char> live(node_file.size(), 0);
+  for(int node : work)
+    live[node] = 1;
+  while(!work.empty()) {
+    int node = work.back();
+    work.pop_back();
+    for(int to : edges[node])
+      if(!live[to]) {
+        live[to] = 1;
+        work.push_back(to);
+      }
+  }
+
+  // live parts of each section are moved together, in same order
+  vector<int64_t> delta(node_file.size(), 0);
+  uint64_t total = 0;
+  uint64_t removed = 0;
+  for(int secNdx = 0; secNdx < sections.size(); secNdx++) {
+    total += sections[secNdx].sh_size;
+    vector<char> content;
+    for(int node : sec_nodes[secNdx]) {
+      delta[node] = static_cast<int64_t>(content.size()) - static_cast<int64_t>(node_base[node]);
+      file_info[node_file[node]].sec_base[secNdx] = content.size();
+      if(!live[node]) {
+        if(node_size[node] > 0)
+          cout << "Removed section : " << find_name_by_sec_ndx(secNdx) << " of " << inFileNames[node_file[node]] << ", " << dec << node_size[node] << " bytes" << endl;
+        removed += node_size[node];
+        continue;
+      }
+      content.insert(content.end(), sec_content[secNdx].begin() + node_base[node], sec_content[secNdx].begin() + node_base[node] + node_size[node]);
+    }
+    sections[secNdx].sh_size = content.size();
+    sec_content[secNdx] = move(content);
+  }
+  for(int f = 0; f < files; f++)
+    for(auto& part : file_info[f].parts)
+      if(part.second.sh_type == SHT_PROGBITS && !live[find_node(f, part.first)])
+        part.second.sh_size = 0;
+
+  vector<char> used(symTbl.size(), 0);
+  used[0] = 1;
+  for(int secNdx = 0; secNdx < reloc.size(); secNdx++) {
+    vector<s_Rela> kept;
+    size_t begin = 0;
+    for(int f = 0; f < files; f++) {
+      auto it = file_info[f].reloc_count.find(secNdx);
+      if(it == file_info[f].reloc_count.end())
+        continue;
+      int from = find_node(f, secNdx);
+      size_t count = it->second;
+      for(size_t i = begin; from >= 0 && live[from] && i < begin + count; i++) {
+        s_Rela rel = reloc[secNdx][i];
+        rel.r_offset += delta[from];
+        const s_SSym &sym = symTbl[rel.r_symval];
+        if(sym.sym_type == STT_SECTION && rel.r_addend != 0)
+          rel.r_addend += delta[find_node(f, sym.sym_ndx)];
+        used[rel.r_symval] = 1;
+        kept.push_back(rel);
+      }
+      it->second = (from >= 0 && live[from]) ? count : 0;
+      begin += count;
+    }
+    reloc[secNdx] = move(kept);
+  }
+
+  vector<int> new_ndx(symTbl.size(), -1);
+  vector<s_SSym> new_syms;
+  vector<int> new_owner;
+  NameTable new_names;
+  for(int i = 0; i < symTbl.size(); i++) {
+    int node = (symTbl[i].sym_ndx != 0) ? find_node(sym_owner[i], symTbl[i].sym_ndx) : -1;
+    if(!used[i] && (node < 0 || !live[node]))
+      continue;
+    new_ndx[i] = new_syms.size();
+    new_syms.push_back(symTbl[i]);
+    if(node >= 0)
+      new_syms.back().sym_value += delta[node];
+    new_owner.push_back(sym_owner[i]);
+    new_names.add(sym_names.name(i));
+  }
+  symTbl = move(new_syms);
+  sym_owner = move(new_owner);
+  sym_names = move(new_names);
+  for(auto& rela : reloc)
+    for(auto& rel : rela)
+      rel.r_symval = new_ndx[rel.r_symval];
+
+  vector<s_LineInfo> lines;
+  size_t line = 0;
+  for(int f = 0; f < files; f++) {
+    uint64_t count = file_info[f].line_count;
+    file_info[f].line_count = 0;
+    for(uint64_t i = 0; i < count; i++, line++) {
+      int node = find_node(f, line_info[line].sec_ndx);
+      if(node < 0 || !live[node])
+        continue;
+      lines.push_back(line_info[line]);
+      lines.back().offset += delta[node];
+      file_info[f].line_count++;
+    }
+  }
+  line_info = move(lines);
+
+  cout << "Garbage collection removed " << dec << removed << " of " << total << " bytes" << endl;
+}
+
+
+void Linker::enable_merge_literals() {
+  merge_literals = true;
+}
+
+
+// Equal entries of literal pools (same 32-bit value, or relocation to same symbol and addend) are
+// shared across parts of merged section. Parts are walked in order, so everything before current
+// part is final and entry is dropped only when all instructions reading it reach last kept equal
+// entry with 12-bit displacement. Sections are then compacted, relocations, symbols, line entries
+// and file_info follow, and displacements of every pool reference are rewritten.
+void Linker::merge_literal_pools() {
+  vector<vector<const s_LitPool *>> sec_pools(sections.size());
+  for(auto& pool : lit_pools)
+    sec_pools[pool.sec_ndx].push_back(&pool);
+  auto part_size = [this](int f, int secNdx) {
+    for(auto& part : file_info[f].parts)
+      if(part.first == secNdx)
+        return part.second.sh_size;
+    return static_cast<uint64_t>(0);
+  };
+  auto fits = [](int64_t disp) { return disp >= -2048 && disp <= 2047; };
+
+  // offsets of dropped entries in each section, ascending
+  vector<vector<uint64_t>> dropped(sections.size());
+  // (section, instruction, entry it reads) in offsets before compaction
+  vector<tuple<int, uint64_t, uint64_t>> fixes;
+  for(int secNdx = 0; secNdx < sections.size(); secNdx++) {
+    if(sec_pools[secNdx].empty())
+      continue;
+    unordered_map<uint64_t, size_t> rel_at;
+    for(size_t i = 0; i < reloc[secNdx].size(); i++)
+      rel_at[reloc[secNdx][i].r_offset] = i;
+    // last kept entry of each value, (offset before, offset after compaction)
+    map<tuple<bool, uint64_t, uint64_t>, pair<uint64_t, uint64_t>> kept;
+    for(const s_LitPool *pool : sec_pools[secNdx]) {
+      uint64_t size = part_size(pool->file, secNdx);
+      if(size == 0)
+        continue;
+      uint64_t base = part_base(pool->file, secNdx);
+      uint64_t shift = dropped[secNdx].size() * WORD_SIZE;
+      vector<vector<uint32_t>> readers((size - pool->start) / WORD_SIZE);
+      for(auto& ref : pool->refs)
+        readers[(ref.pr_entry - pool->start) / WORD_SIZE].push_back(ref.pr_offset);
+      for(uint64_t e = 0; e < readers.size(); e++) {
+        uint64_t entry = base + pool->start + e * WORD_SIZE;
+        auto rel = rel_at.find(entry);
+        uint32_t value;
+        memcpy(&value, sec_content[secNdx].data() + entry, WORD_SIZE);
+        tuple<bool, uint64_t, uint64_t> key = (rel != rel_at.end()) ?
+          make_tuple(true, reloc[secNdx][rel->second].r_symval, reloc[secNdx][rel->second].r_addend) :
+          make_tuple(false, static_cast<uint64_t>(value), static_cast<uint64_t>(0));
+        uint64_t target = entry;
+        auto same = kept.find(key);
+        bool shared = same != kept.end();
+        for(uint32_t instr : readers[e])
+          shared = shared && fits(static_cast<int64_t>(same->second.second) - static_cast<int64_t>(base + instr - shift + WORD_SIZE));
+        if(shared) {
+          target = same->second.first;
+          dropped[secNdx].push_back(entry);
+        } else {
+          kept[key] = make_pair(entry, entry - dropped[secNdx].size() * WORD_SIZE);
+        }
+        for(uint32_t instr : readers[e])
+          fixes.push_back(make_tuple(secNdx, base + instr, target));
+      }
+    }
+  }
+
+  // offset after compaction of offset that is not in dropped entry
+  auto moved = [&dropped](int secNdx, uint64_t offset) {
+    const vector<uint64_t> &d = dropped[secNdx];
+    return offset - (lower_bound(d.begin(), d.end(), offset) - d.begin()) * WORD_SIZE;
+  };
+  auto is_dropped = [&dropped](int secNdx, uint64_t offset) {
+    return binary_search(dropped[secNdx].begin(), dropped[secNdx].end(), offset);
+  };
+
+  uint64_t total = 0;
+  uint64_t removed = 0;
+  for(int secNdx = 0; secNdx < sections.size(); secNdx++) {
+    total += sections[secNdx].sh_size;
+    if(dropped[secNdx].empty())
+      continue;
+    vector<char> content;
+    content.reserve(sec_content[secNdx].size() - dropped[secNdx].size() * WORD_SIZE);
+    uint64_t from = 0;
+    for(uint64_t entry : dropped[secNdx]) {
+      content.insert(content.end(), sec_content[secNdx].begin() + from, sec_content[secNdx].begin() + entry);
+      from = entry + WORD_SIZE;
+    }
+    content.insert(content.end(), sec_content[secNdx].begin() + from, sec_content[secNdx].end());
+    removed += sec_content[secNdx].size() - content.size();
+    sections[secNdx].sh_size = content.size();
+    sec_content[secNdx] = move(content);
+  }
+
+  // relocations of dropped entries go away, counts per file are kept for later passes
+  for(int secNdx = 0; secNdx < reloc.size(); secNdx++) {
+    vector<s_Rela> kept;
+    size_t begin = 0;
+    for(int f = 0; f < inFileNames.size(); f++) {
+      auto it = file_info[f].reloc_count.find(secNdx);
+      if(it == file_info[f].reloc_count.end())
+        continue;
+      size_t count = it->second;
+      it->second = 0;
+      for(size_t i = begin; i < begin + count; i++) {
+        s_Rela rel = reloc[secNdx][i];
+        if(is_dropped(secNdx, rel.r_offset))
+          continue;
+        rel.r_offset = moved(secNdx, rel.r_offset);
+        const s_SSym &sym = symTbl[rel.r_symval];
+        if(sym.sym_type == STT_SECTION && rel.r_addend != 0)
+          rel.r_addend = moved(sym.sym_ndx, rel.r_addend);
+        kept.push_back(rel);
+        it->second++;
+      }
+      begin += count;
+    }
+    reloc[secNdx] = move(kept);
+  }
+  for(auto& sym : symTbl)
+    if(sym.sym_ndx != 0 && sym.sym_ndx < sections.size())
+      sym.sym_value = moved(sym.sym_ndx, sym.sym_value);
+  for(auto& line : line_info)
+    line.offset = moved(line.sec_ndx, line.offset);
+  for(auto& info : file_info) {
+    for(auto& part : info.parts) {
+      if(part.second.sh_type != SHT_PROGBITS)
+        continue;
+      uint64_t base = info.sec_base.at(part.first);
+      part.second.sh_size = moved(part.first, base + part.second.sh_size) - moved(part.first, base);
+      info.sec_base[part.first] = moved(part.first, base);
+    }
+  }
+
+  for(auto& fix : fixes) {
+    int secNdx = get<0>(fix);
+    uint64_t instr = moved(secNdx, get<1>(fix));
+    int64_t disp = static_cast<int64_t>(moved(secNdx, get<2>(fix))) - static_cast<int64_t>(instr + WORD_SIZE);
+    if(!fits(disp)) {
+      cout << "Instruction at offset " << hex << instr << " of section " << find_name_by_sec_ndx(secNdx) << " can't reach its literal" << dec << endl;
+      throw CustomException("*LE : Literal pool displacement doesn't fit in 12 bits");
+    }
+    uint32_t word;
+    memcpy(&word, sec_content[secNdx].data() + instr, WORD_SIZE);
+    word = (word & ~0xfffu) | (static_cast<uint32_t>(disp) & 0xfffu);
+    memcpy(sec_content[secNdx].data() + instr, &word, WORD_SIZE);
+  }
+
+  cout << "Literal pool merging removed " << dec << removed << " of " << total << " bytes" << endl;
+}
+
+
 
-void Linker::read_file(int ndx) {
-  string fileName = inFileNames[ndx];
-  s_FileStruct file;
-  vector<char> elfHdr = read_from_binary(ndx, sizeof(s_ELFHdr));
-  uint64_t secHdrTblOffset = static_cast<uint64_t>(load_data_from_char_vect(elfHdr, sizeof(uint64_t), offsetof(s_ELFHdr, e_shoff)));
-  uint16_t secHdrEntrySize = static_cast<uint16_t>(load_data_from_char_vect(elfHdr, sizeof(uint16_t), offsetof(s_ELFHdr, e_shentsize)));
-  uint16_t secHdrEntries = static_cast<uint16_t>(load_data_from_char_vect(elfHdr, sizeof(uint16_t), offsetof(s_ELFHdr, e_shnum)));
-  uint16_t secStringNdx = static_cast<uint16_t>(load_data_from_char_vect(elfHdr, sizeof(uint16_t), offsetof(s_ELFHdr, e_shstrndx)));
-  vector<char> secHdrTbl = read_from_binary(ndx, (secHdrEntrySize * secHdrEntries), secHdrTblOffset);
-  vector<s_SHdr> sectionHeader = get_section_headers(secHdrTbl, secHdrEntrySize, secHdrEntries);
-  vector<char> secStrings = read_from_binary(ndx, (sectionHeader[secStringNdx].sh_size), sectionHeader[secStringNdx].sh_offset);
-  load_sections_from_file(sectionHeader, secStrings, ndx);
+// Runs on worker thread, touches only input file and tables of this file
+void Linker::parse_file(int ndx) {
+  if(inputData[ndx].data == nullptr) {
+    inputFiles[ndx].reset(new MappedFile(inFileNames[ndx]));
+    inputData[ndx] = inputFiles[ndx]->view();
+  }
+  s_InputTables &tbl = inputTables[ndx];
+  s_ByteView elfHdr = read_from_binary(ndx, sizeof(s_ELFHdr));
+  uint64_t secHdrTblOffset = static_cast<uint64_t>(elfHdr.read(offsetof(s_ELFHdr, e_shoff), sizeof(uint64_t)));
+  uint16_t secHdrEntrySize = static_cast<uint16_t>(elfHdr.read(offsetof(s_ELFHdr, e_shentsize), sizeof(uint16_t)));
+  uint16_t secHdrEntries = static_cast<uint16_t>(elfHdr.read(offsetof(s_ELFHdr, e_shnum), sizeof(uint16_t)));
+  uint16_t secStringNdx = static_cast<uint16_t>(elfHdr.read(offsetof(s_ELFHdr, e_shstrndx), sizeof(uint16_t)));
+  s_ByteView secHdrTbl = read_from_binary(ndx, (secHdrEntrySize * secHdrEntries), secHdrTblOffset);
+  tbl.hdrTbl = get_section_headers(secHdrTbl, secHdrEntrySize, secHdrEntries);
+  const vector<s_SHdr> &hdrTbl = tbl.hdrTbl;
+  if(secStringNdx >= hdrTbl.size())
+    throw CustomException("*LE : Section string table index is out of section header table");
+  tbl.secString = read_from_binary(ndx, (hdrTbl[secStringNdx].sh_size), hdrTbl[secStringNdx].sh_offset);
+  for(int i = 0; i < hdrTbl.size(); i++) {
+    if(hdrTbl[i].sh_type != SHT_SYMTAB && hdrTbl[i].sh_type != SHT_RELA && hdrTbl[i].sh_type != SHT_LINES && hdrTbl[i].sh_type != SHT_POOL)
+      continue;
+    if(hdrTbl[i].sh_link >= hdrTbl.size() || hdrTbl[i].sh_entsize == 0)
+      throw CustomException("*LE : Malformed section header in input file");
+    if(hdrTbl[i].sh_type == SHT_SYMTAB) {
+      tbl.symString = read_from_binary(ndx, hdrTbl[hdrTbl[i].sh_link].sh_size, hdrTbl[hdrTbl[i].sh_link].sh_offset);
+      s_ByteView symtab_vect = read_from_binary(ndx, hdrTbl[i].sh_size, hdrTbl[i].sh_offset);
+      tbl.symTab = get_sym_tab(symtab_vect, hdrTbl[i].sh_entsize, (hdrTbl[i].sh_size / hdrTbl[i].sh_entsize));
+    } else if(hdrTbl[i].sh_type == SHT_RELA) {
+      s_ByteView rela_tab_vect = read_from_binary(ndx, hdrTbl[i].sh_size, hdrTbl[i].sh_offset);
+      tbl.rela[i] = get_rela_tab(rela_tab_vect, hdrTbl[i].sh_entsize, (hdrTbl[i].sh_size / hdrTbl[i].sh_entsize));
+    }
+  }
 }
 
 
-vector<s_SHdr> Linker::get_section_headers(vector<char> sec_hdr_tbl, uint16_t ent_size, uint16_t num) {
+vector<s_SHdr> Linker::get_section_headers(s_ByteView sec_hdr_tbl, uint16_t ent_size, uint16_t num) {
   vector<s_SHdr> temp;
+  temp.reserve(num);
   for(int i = 0; i < num; i++){
-    vector<char> entry(ent_size);
-    copy(sec_hdr_tbl.begin() + i * ent_size, sec_hdr_tbl.begin() + (i+1) * ent_size, entry.begin());
+    s_ByteView entry = sec_hdr_tbl.sub(i * ent_size, ent_size);
     temp.push_back(s_SHdr(
-      static_cast<uint32_t> (load_data_from_char_vect(entry, sizeof(uint32_t), offsetof(s_SHdr, sh_ndx))),
-      static_cast<uint32_t> (load_data_from_char_vect(entry, sizeof(uint32_t), offsetof(s_SHdr, sh_name))),
-      static_cast<uint64_t> (load_data_from_char_vect(entry, sizeof(uint64_t), offsetof(s_SHdr, sh_size))),
-      static_cast<uint32_t> (load_data_from_char_vect(entry, sizeof(uint32_t), offsetof(s_SHdr, sh_type))),
-      static_cast<uint64_t> (load_data_from_char_vect(entry, sizeof(uint64_t), offsetof(s_SHdr, sh_addr))),
-      static_cast<uint64_t> (load_data_from_char_vect(entry, sizeof(uint64_t), offsetof(s_SHdr, sh_offset))),
-      static_cast<uint32_t> (load_data_from_char_vect(entry, sizeof(uint32_t), offsetof(s_SHdr, sh_flags))),
-      static_cast<uint32_t> (load_data_from_char_vect(entry, sizeof(uint32_t), offsetof(s_SHdr, sh_link))),
-      static_cast<uint32_t> (load_data_from_char_vect(entry, sizeof(uint32_t), offsetof(s_SHdr, sh_info))),
-      static_cast<uint64_t> (load_data_from_char_vect(entry, sizeof(uint64_t), offsetof(s_SHdr, sh_addralign))),
-      static_cast<uint64_t> (load_data_from_char_vect(entry, sizeof(uint64_t), offsetof(s_SHdr, sh_entsize)))
+      static_cast<uint32_t> (entry.read(offsetof(s_SHdr, sh_ndx), sizeof(uint32_t))),
+      static_cast<uint32_t> (entry.read(offsetof(s_SHdr, sh_name), sizeof(uint32_t))),
+      static_cast<uint64_t> (entry.read(offsetof(s_SHdr, sh_size), sizeof(uint64_t))),
+      static_cast<uint32_t> (entry.read(offsetof(s_SHdr, sh_type), sizeof(uint32_t))),
+      static_cast<uint64_t> (entry.read(offsetof(s_SHdr, sh_addr), sizeof(uint64_t))),
+      static_cast<uint64_t> (entry.read(offsetof(s_SHdr, sh_offset), sizeof(uint64_t))),
+      static_cast<uint32_t> (entry.read(offsetof(s_SHdr, sh_flags), sizeof(uint32_t))),
+      static_cast<uint32_t> (entry.read(offsetof(s_SHdr, sh_link), sizeof(uint32_t))),
+      static_cast<uint32_t> (entry.read(offsetof(s_SHdr, sh_info), sizeof(uint32_t))),
+      static_cast<uint64_t> (entry.read(offsetof(s_SHdr, sh_addralign), sizeof(uint64_t))),
+      static_cast<uint64_t> (entry.read(offsetof(s_SHdr, sh_entsize), sizeof(uint64_t)))
     ));
   }
   return temp;
 }
 
 
-vector<s_SSym> Linker::get_sym_tab(vector<char> sym_tbl_vect, uint16_t ent_size, uint16_t num){
+vector<s_SSym> Linker::get_sym_tab(s_ByteView sym_tbl_vect, uint16_t ent_size, uint16_t num){
   vector<s_SSym> temp;
+  temp.reserve(num);
   for(int i = 0; i < num; i++) {
-    vector<char> entry(ent_size);
-    copy(sym_tbl_vect.begin() + i * ent_size, sym_tbl_vect.begin() + (i+1) * ent_size, entry.begin());
+    s_ByteView entry = sym_tbl_vect.sub(i * ent_size, ent_size);
     temp.push_back(s_SSym(
-      static_cast<uint32_t> (load_data_from_char_vect(entry, sizeof(uint32_t), offsetof(s_SSym, sym_name))),
-      static_cast<unsigned char> (load_data_from_char_vect(entry, sizeof(unsigned char), offsetof(s_SSym, sym_bind))),
-      static_cast<unsigned char> (load_data_from_char_vect(entry, sizeof(unsigned char), offsetof(s_SSym, sym_type))),
-      static_cast<uint64_t> (load_data_from_char_vect(entry, sizeof(uint64_t), offsetof(s_SSym, sym_value))),
-      static_cast<uint16_t> (load_data_from_char_vect(entry, sizeof(uint16_t), offsetof(s_SSym, sym_ndx))),
-      static_cast<uint64_t> (load_data_from_char_vect(entry, sizeof(uint64_t), offsetof(s_SSym, sym_size)))
+      static_cast<uint32_t> (entry.read(offsetof(s_SSym, sym_name), sizeof(uint32_t))),
+      static_cast<unsigned char> (entry.read(offsetof(s_SSym, sym_bind), sizeof(unsigned char))),
+      static_cast<unsigned char> (entry.read(offsetof(s_SSym, sym_type), sizeof(unsigned char))),
+      static_cast<uint64_t> (entry.read(offsetof(s_SSym, sym_value), sizeof(uint64_t))),
+      static_cast<uint16_t> (entry.read(offsetof(s_SSym, sym_ndx), sizeof(uint16_t))),
+      static_cast<uint64_t> (entry.read(offsetof(s_SSym, sym_size), sizeof(uint64_t)))
     ));
   }
 
@@ -252,54 +820,105 @@ vector<s_SSym> Linker::get_sym_tab(vector<char> sym_tbl_vect, uint16_t ent_size,
 }
 
 
-void Linker::load_sections_from_file(vector<s_SHdr> hdrTbl, vector<char> secString, int fileNdx){
-  vector<char> symString;
-  vector<s_SSym> temp_sym_tab;
+// Merges tables of input file into linker tables. With replace the file was merged before (relink
+// from cache) and its new version takes place of the old one: parts of sections keep their offsets,
+// relocations and line entries go where old ones were, symbols owned by file get new values.
+void Linker::load_sections_from_file(int fileNdx, bool replace){
+  const s_InputTables &tbl = inputTables[fileNdx];
+  s_FileInfo &info = file_info[fileNdx];
+  const vector<s_SHdr> &hdrTbl = tbl.hdrTbl;
+  s_ByteView secString = tbl.secString;
+  s_ByteView symString = tbl.symString;
+  const vector<s_SSym> &temp_sym_tab = tbl.symTab;
   for(int i = 0; i < hdrTbl.size(); i++) {
-    string name = get_name_from_str_array(hdrTbl[i].sh_name, secString);
+    string_view name = get_name_from_str_array(hdrTbl[i].sh_name, secString);
     if(hdrTbl[i].sh_type == SHT_PROGBITS || hdrTbl[i].sh_type == SHT_NULL) {
-      load_progbits(hdrTbl[i], name, fileNdx);
+      load_progbits(hdrTbl[i], name, fileNdx, replace);
     } else if (hdrTbl[i].sh_type == SHT_RELA) {
-      vector<char> rela_tab_vect = read_from_binary(fileNdx, hdrTbl[i].sh_size, hdrTbl[i].sh_offset);
-      vector<s_Rela> rela_tbl = get_rela_tab(rela_tab_vect, hdrTbl[i].sh_entsize, (hdrTbl[i].sh_size / hdrTbl[i].sh_entsize));
-      string nameSec = get_name_from_str_array(hdrTbl[hdrTbl[i].sh_link].sh_name, secString);
+      const vector<s_Rela> &rela_tbl = tbl.rela.at(i);
+      string_view nameSec = get_name_from_str_array(hdrTbl[hdrTbl[i].sh_link].sh_name, secString);
+      int secNdx = sec_names.id(nameSec);
+      uint64_t base = part_base(fileNdx, secNdx);
+      vector<s_Rela> fresh;
+      vector<s_Rela> &sec_reloc = replace ? fresh : reloc[secNdx];
       for(int j = 0; j < rela_tbl.size(); j++) {
-        if(reloc.count(sec_name_ndx[nameSec]) <= 0)
-          reloc.insert(make_pair(sec_name_ndx[nameSec], vector<s_Rela>()));
-        string symName = get_name_from_str_array(temp_sym_tab[rela_tbl[j].r_symval].sym_name, symString);
-        reloc.at(sec_name_ndx[nameSec]).push_back(s_Rela(
-          sections[sec_name_ndx[nameSec]].sh_size - hdrTbl[hdrTbl[i].sh_link].sh_size + rela_tbl[j].r_offset,
-          sym_name_ndx[symName],
+        if(rela_tbl[j].r_symval >= temp_sym_tab.size())
+          throw CustomException("*LE : Relocation refers to symbol out of symbol table");
+        uint64_t offset = base + rela_tbl[j].r_offset;
+        if(offset + WORD_SIZE > sec_content[secNdx].size())
+          throw CustomException("*LE : Relocation is out of section bounds");
+        string_view symName = get_name_from_str_array(temp_sym_tab[rela_tbl[j].r_symval].sym_name, symString);
+        sec_reloc.push_back(s_Rela(
+          offset,
+          sym_names.id(symName),
           rela_tbl[j].r_type,
           0,
           rela_tbl[j].r_size
         ));
-        if(symTbl[sym_name_ndx[symName]].sym_type == STT_SECTION && rela_tbl[j].r_addend != 0) {
-          reloc.at(sec_name_ndx[nameSec])[reloc.at(sec_name_ndx[nameSec]).size() - 1].r_addend = 
-            sections[sec_name_ndx[symName]].sh_size - hdrTbl[temp_sym_tab[rela_tbl[j].r_symval].sym_ndx].sh_size + rela_tbl[j].r_addend;
+        if(symTbl[sym_names.id(symName)].sym_type == STT_SECTION && rela_tbl[j].r_addend != 0) {
+          sec_reloc.back().r_addend = part_base(fileNdx, sec_names.id(symName)) + rela_tbl[j].r_addend;
         }
       }
+      if(replace)
+        reloc[secNdx].insert(reloc[secNdx].begin() + reloc_begin(fileNdx, secNdx) + info.reloc_count[secNdx], fresh.begin(), fresh.end());
+      info.reloc_count[secNdx] += rela_tbl.size();
+    } else if (hdrTbl[i].sh_type == SHT_LINES) {
+      // offsets are moved by size of same named sections from previous files, like relocations
+      s_ByteView lines_vect = read_from_binary(fileNdx, hdrTbl[i].sh_size, hdrTbl[i].sh_offset);
+      string_view nameSec = get_name_from_str_array(hdrTbl[hdrTbl[i].sh_link].sh_name, secString);
+      string srcFile(get_name_from_str_array(hdrTbl[i].sh_info, secString));
+      int secNdx = sec_names.id(nameSec);
+      uint64_t base = part_base(fileNdx, secNdx);
+      vector<s_LineInfo> lines;
+      for(int j = 0; j < hdrTbl[i].sh_size / hdrTbl[i].sh_entsize; j++) {
+        s_ByteView entry = lines_vect.sub(j * hdrTbl[i].sh_entsize, hdrTbl[i].sh_entsize);
+        lines.push_back(s_LineInfo(secNdx,
+          base + static_cast<uint32_t>(entry.read(offsetof(s_LineEnt, le_offset), sizeof(uint32_t))),
+          static_cast<uint32_t>(entry.read(offsetof(s_LineEnt, le_line), sizeof(uint32_t))),
+          srcFile));
+      }
+      auto at = replace ? line_info.begin() + line_begin(fileNdx) + info.line_count : line_info.end();
+      line_info.insert(at, lines.begin(), lines.end());
+      info.line_count += lines.size();
+    } else if (hdrTbl[i].sh_type == SHT_POOL && merge_literals && !replace) {
+      s_ByteView refs_vect = read_from_binary(fileNdx, hdrTbl[i].sh_size, hdrTbl[i].sh_offset);
+      const s_SHdr &secHdr = hdrTbl[hdrTbl[i].sh_link];
+      if(!(secHdr.sh_flags & SEC_FLAGS_MERGE))
+        continue;
+      s_LitPool pool;
+      pool.file = fileNdx;
+      pool.sec_ndx = sec_names.id(get_name_from_str_array(secHdr.sh_name, secString));
+      pool.start = hdrTbl[i].sh_info;
+      if(pool.start > secHdr.sh_size || (secHdr.sh_size - pool.start) % WORD_SIZE != 0)
+        throw CustomException("*LE : Literal pool is out of section bounds");
+      for(int j = 0; j < hdrTbl[i].sh_size / hdrTbl[i].sh_entsize; j++) {
+        s_ByteView entry = refs_vect.sub(j * hdrTbl[i].sh_entsize, hdrTbl[i].sh_entsize);
+        pool.refs.push_back(s_PoolRef(
+          static_cast<uint32_t>(entry.read(offsetof(s_PoolRef, pr_offset), sizeof(uint32_t))),
+          static_cast<uint32_t>(entry.read(offsetof(s_PoolRef, pr_entry), sizeof(uint32_t)))));
+        const s_PoolRef &ref = pool.refs.back();
+        if(ref.pr_offset + WORD_SIZE > pool.start || ref.pr_entry < pool.start || ref.pr_entry >= secHdr.sh_size || (ref.pr_entry - pool.start) % WORD_SIZE != 0)
+          throw CustomException("*LE : Literal pool reference is out of section bounds");
+      }
+      lit_pools.push_back(move(pool));
     } else if (hdrTbl[i].sh_type == SHT_SYMTAB) {
-        symString = read_from_binary(fileNdx, hdrTbl[hdrTbl[i].sh_link].sh_size, hdrTbl[hdrTbl[i].sh_link].sh_offset);
-        vector<char> symtab_vect = read_from_binary(fileNdx, hdrTbl[i].sh_size, hdrTbl[i].sh_offset);
-        temp_sym_tab = get_sym_tab(symtab_vect, hdrTbl[i].sh_entsize, (hdrTbl[i].sh_size / hdrTbl[i].sh_entsize));
-        load_symbols(hdrTbl, i, secString, temp_sym_tab, symString, fileNdx);
+        load_symbols(hdrTbl, i, secString, temp_sym_tab, symString, fileNdx, replace);
     }
   }
 }
 
 
-vector<s_Rela> Linker::get_rela_tab(vector<char> rela_tab_vec, uint16_t ent_size, uint16_t num) {
+vector<s_Rela> Linker::get_rela_tab(s_ByteView rela_tab_vec, uint16_t ent_size, uint16_t num) {
   vector<s_Rela> temp;
+  temp.reserve(num);
   for(int i = 0; i < num; i++) {
-    vector<char> entry(ent_size);
-    copy(rela_tab_vec.begin() + i * ent_size, rela_tab_vec.begin() + (i+1) * ent_size, entry.begin());
+    s_ByteView entry = rela_tab_vec.sub(i * ent_size, ent_size);
     temp.push_back(s_Rela(
-      static_cast<uint64_t> (load_data_from_char_vect(entry, sizeof(uint64_t), offsetof(s_Rela, r_offset))),
-      static_cast<uint64_t> (load_data_from_char_vect(entry, sizeof(uint64_t), offsetof(s_Rela, r_symval))),
-      static_cast<uint32_t> (load_data_from_char_vect(entry, sizeof(uint32_t), offsetof(s_Rela, r_type))),
-      static_cast<uint64_t> (load_data_from_char_vect(entry, sizeof(uint64_t), offsetof(s_Rela, r_addend))),
-      static_cast<uint32_t> (load_data_from_char_vect(entry, sizeof(uint32_t), offsetof(s_Rela, r_size)))
+      static_cast<uint64_t> (entry.read(offsetof(s_Rela, r_offset), sizeof(uint64_t))),
+      static_cast<uint64_t> (entry.read(offsetof(s_Rela, r_symval), sizeof(uint64_t))),
+      static_cast<uint32_t> (entry.read(offsetof(s_Rela, r_type), sizeof(uint32_t))),
+      static_cast<uint64_t> (entry.read(offsetof(s_Rela, r_addend), sizeof(uint64_t))),
+      static_cast<uint32_t> (entry.read(offsetof(s_Rela, r_size), sizeof(uint32_t)))
     ));
   }
 
@@ -308,23 +927,32 @@ vector<s_Rela> Linker::get_rela_tab(vector<char> rela_tab_vec, uint16_t ent_size
 }
 
 
-void Linker::load_symbols(vector<s_SHdr>hdrTbl, int i, vector<char> secString, vector<s_SSym> temp_sym_tab, vector<char> symString, int fileNdx) {
+void Linker::load_symbols(const vector<s_SHdr> &hdrTbl, int i, s_ByteView secString, const vector<s_SSym> &temp_sym_tab, s_ByteView symString, int fileNdx, bool replace) {
     for(int j = 0; j < temp_sym_tab.size(); j++) {
-      string name_sym = get_name_from_str_array(temp_sym_tab[j].sym_name, symString);
-      if(sym_name_ndx.count(name_sym) <= 0) {
-        sym_name_ndx.insert(make_pair(name_sym, symTbl.size()));
+      string_view name_sym = get_name_from_str_array(temp_sym_tab[j].sym_name, symString);
+      int secNdx = sec_names.id(get_name_from_str_array(static_cast<int>(hdrTbl[temp_sym_tab[j].sym_ndx].sh_name), secString));
+      if(replace) {
+        // same symbols as before (checked by can_replace), only values of ones file defines can move
+        int symNdx = sym_names.id(name_sym);
+        if(sym_owner[symNdx] == fileNdx)
+          symTbl[symNdx].sym_value = part_base(fileNdx, secNdx) + temp_sym_tab[j].sym_value;
+        continue;
+      }
+      if(!sym_names.contains(name_sym)) {
+        sym_names.add(name_sym);
         // Value and ndx will be different
         // Ndx will be ndx in the newly created section table, if its not UNDEF(0)
         // Value will be offset in said section(that is possibly concatenated of multiple sections from different files)
         symTbl.push_back(s_SSym(temp_sym_tab[j].sym_name, temp_sym_tab[j].sym_bind, temp_sym_tab[j].sym_type, 
-                              (sections[sec_name_ndx[get_name_from_str_array(static_cast<int>(hdrTbl[temp_sym_tab[j].sym_ndx].sh_name), secString)]].sh_size - hdrTbl[temp_sym_tab[j].sym_ndx].sh_size + temp_sym_tab[j].sym_value), 
-                              sec_name_ndx[get_name_from_str_array(static_cast<int>(hdrTbl[temp_sym_tab[j].sym_ndx].sh_name), secString)], temp_sym_tab[j].sym_size));
+                              part_base(fileNdx, secNdx) + temp_sym_tab[j].sym_value, secNdx, temp_sym_tab[j].sym_size));
+        sym_owner.push_back(fileNdx);
       } else {
         if(temp_sym_tab[j].sym_type != STT_SECTION) {
-          if(symTbl[sym_name_ndx[name_sym]].sym_bind == STB_GLOBAL) {
-            if(symTbl[sym_name_ndx[name_sym]].sym_ndx == 0) {
-              symTbl[sym_name_ndx[name_sym]].sym_ndx = sec_name_ndx[get_name_from_str_array(static_cast<int>(hdrTbl[temp_sym_tab[j].sym_ndx].sh_name), secString)];
-              symTbl[sym_name_ndx[name_sym]].sym_value = sections[sec_name_ndx[get_name_from_str_array(static_cast<int>(hdrTbl[temp_sym_tab[j].sym_ndx].sh_name), secString)]].sh_size - hdrTbl[temp_sym_tab[j].sym_ndx].sh_size + temp_sym_tab[j].sym_value;
+          if(symTbl[sym_names.id(name_sym)].sym_bind == STB_GLOBAL) {
+            if(symTbl[sym_names.id(name_sym)].sym_ndx == 0) {
+              symTbl[sym_names.id(name_sym)].sym_ndx = secNdx;
+              symTbl[sym_names.id(name_sym)].sym_value = part_base(fileNdx, secNdx) + temp_sym_tab[j].sym_value;
+              sym_owner[sym_names.id(name_sym)] = fileNdx;
             } else {
               // Todo : Change report of this
               if(temp_sym_tab[j].sym_ndx != 0) {
@@ -335,58 +963,491 @@ void Linker::load_symbols(vector<s_SHdr>hdrTbl, int i, vector<char> secString, v
           }
         }
       }
+      s_SymSig sig;
+      sig.sym = sym_names.id(name_sym);
+      sig.sec = secNdx;
+      sig.bind = temp_sym_tab[j].sym_bind;
+      sig.type = temp_sym_tab[j].sym_type;
+      sig.size = temp_sym_tab[j].sym_size;
+      file_info[fileNdx].syms.push_back(sig);
     }
 
 }
 
 
-string Linker::get_name_from_str_array(int start_ndx, vector<char> secString) {
-  string temp = "";
-  for(int i = start_ndx; i < secString.size(); i++) {
-    if(secString[i] != 0)
-      temp.push_back(secString[i]);
-    else 
-      return temp;
-  }
-  return temp;
+string_view Linker::get_name_from_str_array(int start_ndx, s_ByteView secString) {
+  // view into string table of mapped input file, valid while linker lives
+  if(start_ndx < 0 || start_ndx >= secString.size)
+    return string_view();
+  const char *start = secString.data + start_ndx;
+  return string_view(start, strnlen(start, secString.size - start_ndx));
 }
 
 
-void Linker::load_progbits(s_SHdr secHdr, string name, int fileNdx){
-  bool new_sec = false;
-  if(sec_name_ndx.count(name) <= 0 ) {
-    sec_name_ndx.insert(make_pair(name, sections.size()));
-    sec_content.insert(make_pair(sections.size(), vector<char>()));
+void Linker::load_progbits(const s_SHdr &secHdr, string_view name, int fileNdx, bool replace){
+  // only copy of section data, straight from mapping into merged output section
+  s_ByteView sec_data = read_from_binary(fileNdx, secHdr.sh_size, secHdr.sh_offset);
+  if(replace) {
+    // part has same size as before, checked by can_replace
+    int secNdx = sec_names.id(name);
+    if(sec_data.size > 0)
+      memcpy(sec_content[secNdx].data() + part_base(fileNdx, secNdx), sec_data.data, sec_data.size);
+    return;
+  }
+  if(!sec_names.contains(name)) {
+    sec_names.add(name);
+    sec_content.push_back(vector<char>());
+    reloc.push_back(vector<s_Rela>());
     // Offset is zero because sections will be defined differently now
-    sections.push_back(s_SHdr(sections.size(), secHdr.sh_name, secHdr.sh_size, secHdr.sh_type, secHdr.sh_addr, 0, secHdr.sh_flags, 
+    sections.push_back(s_SHdr(sections.size(), secHdr.sh_name, 0, secHdr.sh_type, secHdr.sh_addr, 0, secHdr.sh_flags, 
                             secHdr.sh_link, secHdr.sh_info, secHdr.sh_addralign, secHdr.sh_entsize));
-    new_sec = true;
   }
-  vector<char> sec_data = read_from_binary(fileNdx, secHdr.sh_size, secHdr.sh_offset);
-  if(sec_data.size() > 0)
-    sec_content[sec_name_ndx[name]].insert(sec_content[sec_name_ndx[name]].end(), sec_data.begin(), sec_data.end());
-  if(!new_sec)
-    sections[sec_name_ndx[name]].sh_size += secHdr.sh_size;
+  int secNdx = sec_names.id(name);
+  file_info[fileNdx].parts.push_back(make_pair(secNdx, secHdr));
+  file_info[fileNdx].sec_base[secNdx] = sections[secNdx].sh_size;
+  if(sec_data.size > 0) {
+    vector<char> &content = sec_content[secNdx];
+    content.insert(content.end(), sec_data.data, sec_data.data + sec_data.size);
+  }
+  sections[secNdx].sh_size += secHdr.sh_size;
 }
 
 
-size_t Linker::load_data_from_char_vect(vector<char> vect, int size, size_t start_pos){
-  size_t temp;
-  if(start_pos + size <= vect.size())
-    memcpy(&temp, &vect[start_pos], size);
-  else 
-    throw CustomException("*LI : Tried to copy over vector boundary");
-  return temp;
+// Offset of part of merged section that came from input file
+uint64_t Linker::part_base(int fileNdx, int secNdx) {
+  auto it = file_info[fileNdx].sec_base.find(secNdx);
+  if(it == file_info[fileNdx].sec_base.end()) {
+    cout << "Section : " << find_name_by_sec_ndx(secNdx) << " is used but not contained in file : " << inFileNames[fileNdx] << endl;
+    throw CustomException("*LE : Reference to section missing from input file");
+  }
+  return it->second;
 }
 
 
-vector<char> Linker::read_from_binary(int ndx, int chunk, uint32_t start_addr){
-  vector<char> temp(chunk);
-  inputFiles[ndx].seekg(start_addr);
-  inputFiles[ndx].read(temp.data(), chunk);
-  return temp;
+// Relocations and line entries of files are kept in command line order, so ones of a file start
+// after ones of all previous files
+uint64_t Linker::reloc_begin(int fileNdx, int secNdx) {
+  uint64_t begin = 0;
+  for(int i = 0; i < fileNdx; i++) {
+    auto it = file_info[i].reloc_count.find(secNdx);
+    if(it != file_info[i].reloc_count.end())
+      begin += it->second;
+  }
+  return begin;
+}
+
+
+uint64_t Linker::line_begin(int fileNdx) {
+  uint64_t begin = 0;
+  for(int i = 0; i < fileNdx; i++)
+    begin += file_info[i].line_count;
+  return begin;
+}
+
+
+s_ByteView Linker::read_from_binary(int ndx, uint64_t chunk, uint64_t start_addr){
+  return inputData[ndx].sub(start_addr, chunk);
+}
+
+
+MappedFile::MappedFile(string fileName) : fd(-1), mapping(nullptr), length(0) {
+  fd = open(fileName.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw CustomException("*LE : Failed to open input file");
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size < sizeof(s_ELFHdr)) {
+    close(fd);
+    throw CustomException("*LE : Input file is too small to be object file");
+  }
+  length = st.st_size;
+  mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(mapping == MAP_FAILED) {
+    close(fd);
+    throw CustomException("*LE : Failed to map input file");
+  }
 }
+
+
+MappedFile::~MappedFile() {
+  munmap(mapping, length);
+  close(fd);
+}
+// *********************************************************************************************************************
+
 // *********************************************************************************************************************
+// Incremental linking
+// Cache holds merged tables of previous link, with relocated section content, and record of what each
+// input file contributed. Relink takes it as starting point and replaces only input files whose content
+// changed, as long as layout stays same. Cache is raw dump of tables, read back through bounds checks.
+namespace {
+
+// FNV-1a taking 8 bytes at once, inputs are hashed on every relink
+uint64_t content_hash(s_ByteView data) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  size_t i = 0;
+  for(; i + sizeof(uint64_t) <= data.size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data.data + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3ull;
+  }
+  for(; i < data.size; i++) hash = (hash ^ static_cast<unsigned char>(data.data[i])) * 0x100000001b3ull;
+  return hash;
+}
+
+// tables are aligned in cache, so they can be copied straight out of mapping
+#define CACHE_ALIGN 8
+
+template<typename T>
+void put(ostream &out, const T &val) {
+  out.write(reinterpret_cast<const char *>(&val), sizeof(T));
+}
+
+template<typename T>
+void put_vector(ostream &out, const vector<T> &vec) {
+  put<uint64_t>(out, vec.size());
+  static const char pad[CACHE_ALIGN] = {};
+  out.write(pad, (CACHE_ALIGN - out.tellp() % CACHE_ALIGN) % CACHE_ALIGN);
+  out.write(reinterpret_cast<const char *>(vec.data()), vec.size() * sizeof(T));
+}
+
+void put_string(ostream &out, const string &str) {
+  put<uint64_t>(out, str.size());
+  out.write(str.data(), str.size());
+}
+
+struct CacheReader {
+  s_ByteView          view;
+  uint64_t            pos;
+
+  // T may have no default constructor, it is copied out of aligned buffer
+  template<typename T>
+  T get() {
+    alignas(T) char buf[sizeof(T)];
+    memcpy(buf, view.sub(pos, sizeof(T)).data, sizeof(T));
+    pos += sizeof(T);
+    return *reinterpret_cast<T *>(buf);
+  }
+  uint64_t get_count(uint64_t elem_size) {
+    uint64_t count = get<uint64_t>();
+    if(count > (view.size - pos) / elem_size)
+      throw CustomException("*LE : Incremental cache is corrupted");
+    return count;
+  }
+  template<typename T>
+  void get_vector(vector<T> &vec) {
+    uint64_t count = get<uint64_t>();
+    pos += (CACHE_ALIGN - pos % CACHE_ALIGN) % CACHE_ALIGN;
+    if(pos > view.size || count > (view.size - pos) / sizeof(T) || alignof(T) > CACHE_ALIGN)
+      throw CustomException("*LE : Incremental cache is corrupted");
+    const T *data = reinterpret_cast<const T *>(view.data + pos);
+    vec.assign(data, data + count);
+    pos += count * sizeof(T);
+  }
+  string get_string() {
+    uint64_t len = get_count(1);
+    string str(view.sub(pos, len).data, len);
+    pos += len;
+    return str;
+  }
+};
+
+}
+
+
+string Linker::cache_file_name() {
+  return outFileName.substr(0, outFileName.length() - 4) + ".ldcache";
+}
+
+
+void Linker::save_cache() {
+  // files of full link are hashed only now, relink already has hashes of all of them
+  int num = inFileNames.size();
+  run_parallel(num, [this](int i) {
+    if(file_info[i].hash == 0)
+      file_info[i].hash = content_hash(inputData[i]);
+  });
+  // written aside and renamed, so cache is never half written
+  string cacheName = cache_file_name();
+  string tempName = cacheName + ".tmp";
+  ofstream out(tempName, ios::out | ios::trunc | ios::binary);
+  if(!out.is_open())
+    throw CustomException("*LE : Failed to open incremental cache file");
+  out.write(CACHE_MAGIC, strlen(CACHE_MAGIC));
+  put<uint64_t>(out, inFileNames.size());
+  for(auto& name : inFileNames)
+    put_string(out, name);
+  put<uint64_t>(out, address_places.size());
+  for(auto& place : address_places)
+    put_string(out, place);
+  put<char>(out, best_fit);
+  // archive members are in list of files, cache holds while archives stay same
+  put<uint64_t>(out, archives.size());
+  for(auto& ar : archives) {
+    put_string(out, ar.name);
+    put<uint64_t>(out, content_hash(ar.file->view()));
+  }
+
+  put_vector(out, sections);
+  for(int i = 0; i < sections.size(); i++) {
+    put_string(out, sec_names.name(i));
+    put_vector(out, sec_content[i]);
+    put_vector(out, reloc[i]);
+  }
+  put_vector(out, symTbl);
+  for(int i = 0; i < symTbl.size(); i++)
+    put_string(out, sym_names.name(i));
+  put_vector(out, sym_vals);
+  put_vector(out, sym_owner);
+  put<uint64_t>(out, layout.size());
+  for(auto& elem : layout) {
+    put(out, elem.first);
+    put(out, elem.second);
+  }
+  put<uint64_t>(out, line_info.size());
+  for(auto& line : line_info) {
+    put(out, line.sec_ndx);
+    put(out, line.offset);
+    put(out, line.line);
+    put_string(out, line.file);
+  }
+  for(auto& info : file_info) {
+    put(out, info.hash);
+    put<uint64_t>(out, info.parts.size());
+    for(auto& part : info.parts) {
+      put(out, part.first);
+      put(out, part.second);
+    }
+    put<uint64_t>(out, info.sec_base.size());
+    for(auto& base : info.sec_base) {
+      put(out, base.first);
+      put(out, base.second);
+    }
+    put_vector(out, info.syms);
+    put<uint64_t>(out, info.reloc_count.size());
+    for(auto& count : info.reloc_count) {
+      put(out, count.first);
+      put(out, count.second);
+    }
+    put(out, info.line_count);
+  }
+  out.close();
+  if(!out || rename(tempName.c_str(), cacheName.c_str()) != 0)
+    throw CustomException("*LE : Failed to write incremental cache file");
+}
+
+
+// False when there is no cache or it was made for other inputs or options
+bool Linker::load_cache() {
+  MappedFile file(cache_file_name());
+  CacheReader in = {file.view(), 0};
+  if(string(in.view.sub(0, strlen(CACHE_MAGIC)).data, strlen(CACHE_MAGIC)) != CACHE_MAGIC)
+    return false;
+  in.pos = strlen(CACHE_MAGIC);
+  vector<string> names(in.get_count(sizeof(uint64_t)));
+  for(auto& name : names)
+    name = in.get_string();
+  vector<string> places(in.get_count(sizeof(uint64_t)));
+  for(auto& place : places)
+    place = in.get_string();
+  if(names.size() < inFileNames.size() || !equal(inFileNames.begin(), inFileNames.end(), names.begin()) ||
+     places != address_places || in.get<char>() != best_fit)
+    return false;
+  if(in.get<uint64_t>() != archives.size())
+    return false;
+  for(int i = 0; i < archives.size(); i++) {
+    if(in.get_string() != archives[i].name)
+      return false;
+    load_archive(i);
+    if(in.get<uint64_t>() != content_hash(archives[i].file->view()))
+      return false;
+  }
+  // members pulled from archives follow files from command line
+  inFileNames = names;
+
+  in.get_vector(sections);
+  sec_content.resize(sections.size());
+  reloc.resize(sections.size());
+  for(int i = 0; i < sections.size(); i++) {
+    sec_names.add(in.get_string());
+    in.get_vector(sec_content[i]);
+    in.get_vector(reloc[i]);
+  }
+  in.get_vector(symTbl);
+  for(int i = 0; i < symTbl.size(); i++)
+    sym_names.add(in.get_string());
+  in.get_vector(sym_vals);
+  in.get_vector(sym_owner);
+  layout.resize(in.get_count(sizeof(uint32_t) + sizeof(int)));
+  for(auto& elem : layout) {
+    elem.first = in.get<uint32_t>();
+    elem.second = in.get<int>();
+  }
+  line_info.resize(in.get_count(3 * sizeof(uint32_t) + sizeof(uint64_t)));
+  for(auto& line : line_info) {
+    line.sec_ndx = in.get<decltype(line.sec_ndx)>();
+    line.offset = in.get<decltype(line.offset)>();
+    line.line = in.get<decltype(line.line)>();
+    line.file = in.get_string();
+  }
+  file_info.resize(inFileNames.size());
+  for(auto& info : file_info) {
+    info.hash = in.get<uint64_t>();
+    uint64_t parts = in.get_count(sizeof(int) + sizeof(s_SHdr));
+    for(uint64_t i = 0; i < parts; i++) {
+      int secNdx = in.get<int>();
+      info.parts.push_back(make_pair(secNdx, in.get<s_SHdr>()));
+    }
+    uint64_t bases = in.get_count(sizeof(int) + sizeof(uint64_t));
+    for(uint64_t i = 0; i < bases; i++) {
+      int secNdx = in.get<int>();
+      info.sec_base[secNdx] = in.get<uint64_t>();
+    }
+    in.get_vector(info.syms);
+    uint64_t counts = in.get_count(sizeof(int) + sizeof(uint64_t));
+    for(uint64_t i = 0; i < counts; i++) {
+      int secNdx = in.get<int>();
+      info.reloc_count[secNdx] = in.get<uint64_t>();
+    }
+    info.line_count = in.get<uint64_t>();
+  }
+  if(in.pos != in.view.size || sym_vals.size() != symTbl.size() || sym_owner.size() != symTbl.size())
+    throw CustomException("*LE : Incremental cache is corrupted");
+  return true;
+}
+
+
+// New version of input file can take place of old one only if it changes nothing but content of its
+// sections: same parts with same headers in same order, same symbols in same sections, relocations
+// and line entries only in its own sections.
+bool Linker::can_replace(int fileNdx) {
+  const s_InputTables &tbl = inputTables[fileNdx];
+  const s_FileInfo &info = file_info[fileNdx];
+  const vector<s_SHdr> &hdrTbl = tbl.hdrTbl;
+  auto sec_of = [&](uint64_t hdrNdx) {
+    return (hdrNdx < hdrTbl.size()) ? sec_names.find(get_name_from_str_array(hdrTbl[hdrNdx].sh_name, tbl.secString)) : -1;
+  };
+  int part = 0;
+  for(int i = 0; i < hdrTbl.size(); i++) {
+    const s_SHdr &hdr = hdrTbl[i];
+    if(hdr.sh_type == SHT_PROGBITS || hdr.sh_type == SHT_NULL) {
+      if(part >= info.parts.size() || info.parts[part].first != sec_of(i))
+        return false;
+      const s_SHdr &old = info.parts[part++].second;
+      if(hdr.sh_type != old.sh_type || hdr.sh_size != old.sh_size || hdr.sh_flags != old.sh_flags || hdr.sh_addr != old.sh_addr ||
+         hdr.sh_link != old.sh_link || hdr.sh_info != old.sh_info || hdr.sh_addralign != old.sh_addralign || hdr.sh_entsize != old.sh_entsize)
+        return false;
+    } else if(hdr.sh_type == SHT_RELA || hdr.sh_type == SHT_LINES) {
+      int secNdx = sec_of(hdr.sh_link);
+      if(secNdx < 0 || info.sec_base.count(secNdx) == 0)
+        return false;
+      if(hdr.sh_type == SHT_LINES)
+        continue;
+      for(auto& rel : tbl.rela.at(i)) {
+        if(rel.r_symval >= tbl.symTab.size() || info.sec_base.at(secNdx) + rel.r_offset + WORD_SIZE > sec_content[secNdx].size())
+          return false;
+        const s_SSym &sym = tbl.symTab[rel.r_symval];
+        if(sym.sym_type == STT_SECTION && rel.r_addend != 0 && info.sec_base.count(sec_of(sym.sym_ndx)) == 0)
+          return false;
+      }
+    }
+  }
+  if(part != info.parts.size() || tbl.symTab.size() != info.syms.size())
+    return false;
+  for(int j = 0; j < tbl.symTab.size(); j++) {
+    const s_SSym &sym = tbl.symTab[j];
+    s_SymSig sig;
+    sig.sym = sym_names.find(get_name_from_str_array(sym.sym_name, tbl.symString));
+    sig.sec = sec_of(sym.sym_ndx);
+    sig.bind = sym.sym_bind;
+    sig.type = sym.sym_type;
+    sig.size = sym.sym_size;
+    if(!(sig == info.syms[j]))
+      return false;
+  }
+  return true;
+}
+
+
+void Linker::replace_file(int fileNdx) {
+  s_FileInfo &info = file_info[fileNdx];
+  for(auto& count : info.reloc_count) {
+    vector<s_Rela> &sec_reloc = reloc[count.first];
+    auto begin = sec_reloc.begin() + reloc_begin(fileNdx, count.first);
+    sec_reloc.erase(begin, begin + count.second);
+    count.second = 0;
+  }
+  auto lines = line_info.begin() + line_begin(fileNdx);
+  line_info.erase(lines, lines + info.line_count);
+  info.line_count = 0;
+  load_sections_from_file(fileNdx, true);
+  inputTables[fileNdx] = s_InputTables();
+}
+
+
+// Relinks from cache of previous link. Changed files are parsed and put in place of old ones, then
+// only their relocations and relocations of symbols that moved are applied again. False when it
+// can't be done (no usable cache, layout or symbols changed) and full link is needed.
+bool Linker::relink(int &changed) {
+  // only files from command line can change, archive members come from unchanged archives
+  int objects = inFileNames.size();
+  vector<int> dirty_files;
+  try {
+    if(!load_cache())
+      return false;
+    int num = inFileNames.size();
+    inputFiles.resize(num);
+    inputData.resize(num);
+    inputTables.resize(num);
+    vector<uint64_t> hashes(objects);
+    run_parallel(objects, [this, &hashes](int i) {
+      inputFiles[i].reset(new MappedFile(inFileNames[i]));
+      inputData[i] = inputFiles[i]->view();
+      hashes[i] = content_hash(inputData[i]);
+    });
+    for(int i = 0; i < objects; i++) {
+      if(hashes[i] != file_info[i].hash)
+        dirty_files.push_back(i);
+      file_info[i].hash = hashes[i];
+    }
+    run_parallel(dirty_files.size(), [this, &dirty_files](int i) { parse_file(dirty_files[i]); });
+    for(int fileNdx : dirty_files)
+      if(!can_replace(fileNdx))
+        return false;
+  } catch(const exception &e) {
+    return false;
+  }
+
+  vector<uint32_t> old_vals = sym_vals;
+  for(int fileNdx : dirty_files)
+    replace_file(fileNdx);
+  resolve_symbols();
+  vector<char> moved(sym_vals.size());
+  bool any_moved = false;
+  for(int i = 0; i < sym_vals.size(); i++) {
+    moved[i] = (sym_vals[i] != old_vals[i]);
+    any_moved = any_moved || moved[i];
+  }
+  int num = inFileNames.size();
+  vector<char> dirty(num, 0);
+  for(int fileNdx : dirty_files)
+    dirty[fileNdx] = 1;
+  run_parallel(reloc.size(), [&](int secNdx) {
+    size_t begin = 0;
+    for(int i = 0; i < num; i++) {
+      auto it = file_info[i].reloc_count.find(secNdx);
+      if(it == file_info[i].reloc_count.end())
+        continue;
+      if(dirty[i])
+        apply_relocations(secNdx, begin, begin + it->second);
+      else if(any_moved)
+        apply_relocations(secNdx, begin, begin + it->second, &moved);
+      begin += it->second;
+    }
+  });
+  changed = dirty_files.size();
+  return true;
+}
+
 
 int main(int argc, char const *argv[]) {
   string outFile;
@@ -404,10 +1465,18 @@ int main(int argc, char const *argv[]) {
     // For executing via debugger
     int hex = -1;
     int opt = -1;
+    int jobs = 0;
+    bool listing = true;
+    bool best_fit = false;
+    bool incremental = false;
+    bool gc_sections = false;
+    bool merge_literals = false;
+    vector<string> keep = vector<string>();
     vector<int> place = vector<int> ();
     vector<string> places = vector<string>();
     outFile = "";
     vector<string> inFiles = vector<string> ();
+    vector<string> arFiles = vector<string> ();
     int i = 2; // For debug execution
     i = 1; // For normal execution
     for(i; i < arr_arg.size(); i++){
@@ -416,11 +1485,34 @@ int main(int argc, char const *argv[]) {
       else if(arr_arg[i].find("-place") == 0) {
         place.push_back(i);
         places.push_back(arr_arg[i]);
+      } else if(arr_arg[i] == "-fit=best" || arr_arg[i] == "-fit=first") {
+        best_fit = (arr_arg[i] == "-fit=best");
+      } else if(arr_arg[i] == "-no_listing") {
+        listing = false;
+      } else if(arr_arg[i] == "-incremental") {
+        incremental = true;
+      } else if(arr_arg[i] == "--gc-sections") {
+        gc_sections = true;
+      } else if(arr_arg[i] == "-merge_literals") {
+        merge_literals = true;
+      } else if(arr_arg[i].find("-keep=") == 0) {
+        keep.push_back(arr_arg[i].substr(6));
+      } else if(arr_arg[i].find("-jobs=") == 0) {
+        try {
+          jobs = stoi(arr_arg[i].substr(6));
+        } catch(...) {
+          throw CustomException("*LE : Invalid -jobs value");
+        }
+        if(jobs <= 0) throw CustomException("*LE : Invalid -jobs value");
       }else if (arr_arg[i] == "-o"){
         opt = i++;
         outFile = arr_arg[i];
       } else {
-        if(arr_arg[i].substr(arr_arg[i].length() - 2) != ".o") throw CustomException("*LE : You must pass only object files (.o)");
+        if(arr_arg[i].length() >= 2 && arr_arg[i].substr(arr_arg[i].length() - 2) == ".a") {
+          arFiles.push_back(arr_arg[i]);
+          continue;
+        }
+        if(arr_arg[i].substr(arr_arg[i].length() - 2) != ".o") throw CustomException("*LE : You must pass only object files (.o) or archives (.a)");
         inFiles.push_back(arr_arg[i]);
       }
     }
@@ -429,24 +1521,61 @@ int main(int argc, char const *argv[]) {
     if(opt < 0) throw CustomException("*LE : -o option not specified");
     if(inFiles.size() == 0) throw CustomException("*LE : No input files specified");
     if(outFile.substr(outFile.length() - 4) != ".hex") throw CustomException("*LE : Output file doesn't have hex suffix");
+    if(!keep.empty() && !gc_sections) throw CustomException("*LE : -keep is used only with --gc-sections");
+    // cache records parts of sections as they are in input files, collection moves them
+    if(incremental && gc_sections) throw CustomException("*LE : -incremental can't be used with --gc-sections");
+    if(incremental && merge_literals) throw CustomException("*LE : -incremental can't be used with -merge_literals");
 
     // For normal execution
     // for(int i = 1; i < num_arg.size(); i++){
 
     // }
 
-    Linker ld(outFile, inFiles, places);
+    // relink from cache when it is usable, full link otherwise
+    int changed = -1;
+    if(incremental) {
+      Linker ld(outFile, inFiles, arFiles, places, jobs, listing, best_fit);
+      if(ld.relink(changed)) {
+        if(listing) {
+          ld.print_sym_values();
+          ld.print_header_table();
+          ld.print_symbol_table();
+          ld.print_reloc_table();
+        }
+        ld.write_hex();
+        ld.print_symbol_map();
+        ld.print_line_table();
+        // cache of unchanged inputs is still current
+        if(changed > 0)
+          ld.save_cache();
+        cout << "Incremental linking to " << outFile << " done, " << changed << " of " << inFiles.size() << " objects relinked" << endl;
+      }
+    }
 
-    ld.first_pass();
-    // ld.print_header_table();
-    // ld.print_symbol_table();
-    // ld.print_reloc_table();
-    ld.second_pass();
-    ld.print_header_table();
-    ld.print_symbol_table();
-    ld.print_reloc_table();
+    if(changed < 0) {
+      Linker ld(outFile, inFiles, arFiles, places, jobs, listing, best_fit);
+      if(gc_sections)
+        ld.enable_gc_sections(keep);
+      if(merge_literals)
+        ld.enable_merge_literals();
 
-    cout << "Linking to " << outFile << " done" << endl;
+      ld.first_pass();
+      // ld.print_header_table();
+      // ld.print_symbol_table();
+      // ld.print_reloc_table();
+      ld.second_pass();
+      if(listing) {
+        ld.print_header_table();
+        ld.print_symbol_table();
+        ld.print_reloc_table();
+      }
+      ld.print_symbol_map();
+      ld.print_line_table();
+      if(incremental)
+        ld.save_cache();
+
+      cout << "Linking to " << outFile << " done" << endl;
+    }
 
   } catch(const std::exception &e){
     // char filename[outFile.length()] = outFile;
@@ -516,35 +1645,74 @@ void Linker::print_symbol_table() {
 
 
 void Linker::print_reloc_table(){
-  for(auto& elem : reloc) {
-    helperFile << ".rela." << find_name_by_sec_ndx(elem.first) << endl;
+  for(int secNdx = 0; secNdx < reloc.size(); secNdx++) {
+    const vector<s_Rela> &rela = reloc[secNdx];
+    if(rela.empty())
+      continue;
+    helperFile << ".rela." << find_name_by_sec_ndx(secNdx) << endl;
     helperFile << setw(20) << setfill(' ') << left << "Offset " << 
       setw(20) << setfill(' ') << left << "Type " <<
       setw(20) << setfill(' ') << left << "Sym. Val. " << 
       setw(20) << setfill(' ') << left << "Addend" << 
       setw(20) << setfill(' ') << left << "Size " << endl;
-    for(int i = 0; i < elem.second.size(); i++) {
-    helperFile << setw(20) << setfill(' ') << left << elem.second[i].r_offset << 
-      setw(20) << setfill(' ') << left << elem.second[i].r_type <<
-      setw(20) << setfill(' ') << left << find_name_by_sym_ndx(elem.second[i].r_symval) << 
-      setw(20) << setfill(' ') << left << elem.second[i].r_addend << 
-      setw(20) << setfill(' ') << left << elem.second[i].r_size << endl;
+    for(int i = 0; i < rela.size(); i++) {
+    helperFile << setw(20) << setfill(' ') << left << rela[i].r_offset << 
+      setw(20) << setfill(' ') << left << rela[i].r_type <<
+      setw(20) << setfill(' ') << left << find_name_by_sym_ndx(rela[i].r_symval) << 
+      setw(20) << setfill(' ') << left << rela[i].r_addend << 
+      setw(20) << setfill(' ') << left << rela[i].r_size << endl;
     }
   }
 }
 
-string Linker::find_name_by_sec_ndx(int ndx){
-  for(auto& elem : sec_name_ndx)
-    if(elem.second == ndx)
-      return elem.first;
-  return "";
+void Linker::print_sym_values() {
+  helperFile << "Sym values:" << endl << setw(5) << setfill(' ') << "Ndx: " << setw(25) << setfill(' ') << "Name: " << setw(25) << setfill(' ') << "Value: " << endl;
+  for(int i = 0; i < symTbl.size(); i++) {
+    helperFile << setw(5) << setfill(' ') << i << setw(25) << setfill(' ') << find_name_by_sym_ndx(i) << setw(25) << setfill(' ') << hex << sym_vals[i] << endl;
+  }
+}
+
+
+// Symbol map used by emulator for reports, one "address name" pair per line sorted by address.
+// Section symbols come before labels on the same address, so label is the one that is kept.
+void Linker::print_symbol_map() {
+  vector<pair<uint32_t, pair<int, string>>> entries;
+  for(int i = 1; i < symTbl.size(); i++)
+    entries.push_back(make_pair(sym_vals[i], make_pair((symTbl[i].sym_type == STT_SECTION) ? 0 : 1, find_name_by_sym_ndx(i))));
+  sort(entries.begin(), entries.end());
+  for(auto& elem : entries)
+    symFile << setw(8) << setfill('0') << right << hex << elem.first << " " << elem.second.second << endl;
 }
 
 
-string Linker::find_name_by_sym_ndx(int ndx){
-  for(auto& elem : sym_name_ndx)
-    if(elem.second == ndx)
-      return elem.first;
-  return "";
+// Line table used by emulator for coverage, "address line file" per line sorted by address.
+// Written only when some of the objects were assembled with line table.
+void Linker::print_line_table() {
+  string linesFileName = outFileName.substr(0, outFileName.length() - 4) + ".lines";
+  // table left by earlier -g link would not match this image
+  if(line_info.empty()) {
+    remove(linesFileName.c_str());
+    return;
   }
+  ofstream linesFile(linesFileName, ios::out | ios::trunc);
+  if(!linesFile.is_open())
+    throw CustomException("*LE : Failed to open line table file");
+  vector<pair<uint32_t, int>> order;
+  for(int i = 0; i < line_info.size(); i++)
+    order.push_back(make_pair(sections[line_info[i].sec_ndx].sh_addr + line_info[i].offset, i));
+  sort(order.begin(), order.end());
+  for(auto& elem : order)
+    linesFile << setw(8) << setfill('0') << right << hex << elem.first << " " << dec << line_info[elem.second].line << " " << line_info[elem.second].file << endl;
+  linesFile.close();
+}
+
+
+const string &Linker::find_name_by_sec_ndx(int ndx){
+  return sec_names.name(ndx);
+}
+
+
+const string &Linker::find_name_by_sym_ndx(int ndx){
+  return sym_names.name(ndx);
+}
 // **************************************************************************************************************************
\ No newline at end of file
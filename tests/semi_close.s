@@ -0,0 +1,32 @@
+# file: semi_close.s
+# run with -semihost, close of stdout is refused and later write to it still prints
+# expected: "Hello world" and exit status 12 (bytes written)
+
+.global my_start, msg
+
+.section my_code
+my_start:
+
+    ld $0xFFFFFEFE, %sp
+
+    # close(1), returns 0xFFFFFFFF
+    ld $1, %r1
+    ld $4, %r4
+    st %r4, 0xFFFFFF60
+
+    # write(1, msg, 12)
+    ld $1, %r1
+    ld $msg, %r2
+    ld $12, %r3
+    ld $1, %r4
+    st %r4, 0xFFFFFF60
+
+    # exit(bytes written)
+    ld $6, %r4
+    st %r4, 0xFFFFFF60
+    halt
+
+msg:
+.word 0x6c6c6548, 0x6f77206f, 0x0a646c72
+
+.end
@@ -0,0 +1,26 @@
+#!/bin/bash
+# Runs every program of benchmark corpus through emulator verify mode and lists programs where engines diverge.
+# Usage : ./verify.sh [corpus dir] [emulator options, e.g. -verify=1000]
+
+EMULATOR=${EMULATOR:-./emu}
+CORPUS=${1:-.}
+shift
+
+TOTAL=0
+FAILED=0
+for HEX in "${CORPUS}"/*.hex; do
+  [ -e "${HEX}" ] || continue
+  TOTAL=$((TOTAL + 1))
+  OUT=$(${EMULATOR} -verify "$@" "${HEX}" 2>&1)
+  if echo "${OUT}" | grep -q "^Engines match"; then
+    echo "ok      ${HEX}"
+  else
+    FAILED=$((FAILED + 1))
+    echo "FAILED  ${HEX}"
+    echo "${OUT}" | sed -n '/^Engines diverge/,$p'
+    echo "${OUT}" | grep "^\*EE" | tail -1
+  fi
+done
+
+echo "${TOTAL} programs, ${FAILED} diverged"
+[ ${FAILED} -eq 0 ]